@@ -0,0 +1,510 @@
+/// ? uComms benchmarks
+/// Parser cost per byte on synthetic streams, CRC throughput, zero copy receive
+/// against read and copy, one parser group against a context per stream at 8,
+/// 64 and 512 streams, and end-to-end
+/// frames/s and round-trip latency through a pty pair with a forked device
+/// that echoes every frame back.
+/// Output is one row per measurement, CSV by default or JSON with --json, so
+/// runs can be diffed between releases. --quick shrinks every run for smoke
+/// testing.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <poll.h>
+#include <pty.h>         /// openpty()
+#include <signal.h>
+#include <fcntl.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "checks.h"
+#include "ucoms.h"
+#include "frame.h"
+#include "tx.h"
+#include "port.h"
+#include "tlv.h"
+#include "lz.h"
+#include "rxring.h"
+#include "group.h"
+
+
+/// * Reporting
+
+static int json_output = 0;
+static int quick = 0;
+static int rows = 0;
+
+void report_begin(void) {
+    if (json_output) printf("[\n");
+    else printf("bench,case,metric,value,unit\n");
+}
+
+void report(const char *bench, const char *name, const char *metric, double value, const char *unit) {
+    if (json_output) {
+        printf("%s  {\"bench\": \"%s\", \"case\": \"%s\", \"metric\": \"%s\", \"value\": %.6g, \"unit\": \"%s\"}",
+               rows ? ",\n" : "", bench, name, metric, value, unit);
+    } else {
+        printf("%s,%s,%s,%.6g,%s\n", bench, name, metric, value, unit);
+    }
+    rows++;
+    fflush(stdout);
+}
+
+void report_end(void) {
+    if (json_output) printf("\n]\n");
+}
+
+double now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec * 1e9 + (double)ts.tv_nsec;
+}
+
+/// ? Keeps the optimiser from throwing measured work away.
+static volatile uint64_t sink;
+
+
+/// * Synthetic streams
+
+// Fills out with back to back frames of payload_len bytes, escape_pct percent
+// of the payload bytes being reserved. Returns the stream size.
+size_t build_stream(uint8_t *out, size_t cap, size_t payload_len, int escape_pct, uint8_t crc_mode) {
+    static uint8_t payload[uCOMMS_MAX_FRAME_PAYLOAD];
+    size_t n = 0;
+    srand(1234);
+    while (n + uCOMMS_ENCODED_MAX(payload_len) <= cap) {
+        for (size_t i = 0; i < payload_len; i++) {
+            uint8_t b;
+            if (rand() % 100 < escape_pct) {
+                b = (uint8_t[]){START_BYTE, STOP_BYTE, ESC_BYTE}[rand() % 3];
+            } else {
+                do { b = (uint8_t)rand(); } while (IS_RESERVED_BYTE(b));
+            }
+            payload[i] = b;
+        }
+        n += encode_frame_crc(crc_mode, payload, payload_len, out + n, cap - n);
+    }
+    return n;
+}
+
+
+/// * Parser benchmarks
+
+void bench_parser(void) {
+    const size_t sizes[] = {8, 60, 1000, 4000};
+    const int    escapes[] = {0, 1, 10};
+    const size_t stream_cap = 4 << 20;
+    uint8_t *stream = malloc(stream_cap);
+    static char big_buf[uCOMMS_MAX_BUFFER_SIZE];
+    CHECK_PTR(stream);
+
+    for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+        for (size_t e = 0; e < sizeof(escapes) / sizeof(escapes[0]); e++) {
+            size_t len = build_stream(stream, quick ? stream_cap / 16 : stream_cap, sizes[s], escapes[e], uCOMMS_CRC_NONE);
+            char name[64];
+            snprintf(name, sizeof(name), "payload%zu_esc%d", sizes[s], escapes[e]);
+
+            uCOMMS_CONTEXT ctx = {0};
+            if (sizes[s] > uCOMMS_MAX_PAYLOAD) attach_buffer(&ctx, big_buf, sizeof(big_buf));
+
+            double t0 = now_ns();
+            uint64_t frames = 0;
+            for (size_t i = 0; i < len; i++) frames += parse_cmd(&ctx, (char)stream[i]) == PARSE_FRAME;
+            double t1 = now_ns();
+            report("parse_cmd", name, "ns_per_byte", (t1 - t0) / (double)len, "ns");
+
+            t0 = now_ns();
+            for (size_t off = 0; off < len;) {
+                off += parse_buf(&ctx, stream + off, len - off);
+                frames += frame_ready(&ctx);
+            }
+            t1 = now_ns();
+            report("parse_buf", name, "ns_per_byte", (t1 - t0) / (double)len, "ns");
+            report("parse_buf", name, "MB_per_s", (double)len / ((t1 - t0) / 1e9) / 1e6, "MB/s");
+            sink += frames;
+        }
+    }
+    free(stream);
+}
+
+
+/// * CRC benchmarks
+
+void bench_crc(void) {
+    const size_t len = quick ? (1 << 20) : (16 << 20);
+    uint8_t *buf = malloc(len);
+    CHECK_PTR(buf);
+    for (size_t i = 0; i < len; i++) buf[i] = (uint8_t)(i * 2654435761u >> 24);
+
+    struct {
+        const char *name;
+        uint8_t     mode;
+        int         sw;
+    } cases[] = {
+        {"crc16",           uCOMMS_CRC16,  0},
+        {"crc32c_slice8",   uCOMMS_CRC32C, 1},
+        {"crc32c",          uCOMMS_CRC32C, 0},   /// ? SSE4.2 when the CPU has it
+    };
+
+    for (size_t c = 0; c < sizeof(cases) / sizeof(cases[0]); c++) {
+        uint32_t crc = crc_begin(cases[c].mode);
+        double t0 = now_ns();
+        crc = cases[c].sw ? crc32c_update_sw(crc, buf, len) : crc_update(cases[c].mode, crc, buf, len);
+        double t1 = now_ns();
+        sink += crc;
+        report("crc", cases[c].name, "ns_per_byte", (t1 - t0) / (double)len, "ns");
+        report("crc", cases[c].name, "MB_per_s", (double)len / ((t1 - t0) / 1e9) / 1e6, "MB/s");
+    }
+    free(buf);
+
+    /// ? What the trailer costs inside the parser.
+    const size_t stream_cap = quick ? (256 << 10) : (4 << 20);
+    uint8_t *stream = malloc(stream_cap);
+    CHECK_PTR(stream);
+    const char *names[] = {"none", "crc16", "crc32c"};
+    for (uint8_t mode = uCOMMS_CRC_NONE; mode <= uCOMMS_CRC32C; mode++) {
+        size_t slen = build_stream(stream, stream_cap, 60, 1, mode);
+        uCOMMS_CONTEXT ctx = {.crc_mode = mode};
+        uint64_t frames = 0;
+        double t0 = now_ns();
+        for (size_t off = 0; off < slen;) {
+            off += parse_buf(&ctx, stream + off, slen - off);
+            frames += frame_ready(&ctx);
+        }
+        double t1 = now_ns();
+        sink += frames;
+        report("parse_buf_crc", names[mode], "ns_per_byte", (t1 - t0) / (double)slen, "ns");
+    }
+    free(stream);
+}
+
+
+/// * Payload compression
+
+// Ratio and CPU cost of ucomms_pack()/ucomms_unpack() per frame, and what the
+// saved bytes are worth on a 9600 baud line (10 bits per byte on the wire).
+void bench_lz(void) {
+    static uint8_t text[4096], tlv[4096], noise[4096];
+    size_t tlen = 0;
+    for (int k = 0; tlen + 40 < sizeof(text); k++) {
+        tlen += (size_t)snprintf((char *)text + tlen, sizeof(text) - tlen, "GET:FR=%d,TEMP=21.%d,STATE=OK;", k % 50, k % 10);
+    }
+    uCOMMS_TLV_WRITER w;
+    tlv_begin(&w, tlv, sizeof(tlv), 1);
+    for (uint32_t k = 0; w.len + 16 < sizeof(tlv); k++) {
+        tlv_put_uint(&w, 1, k);
+        tlv_put_sint(&w, 2, -(int64_t)(k % 7));
+        tlv_put_u16(&w, 3, (uint16_t)(512 + k % 16));
+    }
+    srand(99);
+    for (size_t i = 0; i < sizeof(noise); i++) noise[i] = (uint8_t)rand();
+
+    const struct { const char *name; const uint8_t *data; } sets[] = {
+        {"text", text}, {"tlv", tlv}, {"random", noise},
+    };
+    const size_t sizes[] = {60, 1000, 4000};
+    const int    iters   = quick ? 200 : 20000;
+    static uint8_t packed[4096 + 1], back[4096];
+
+    for (size_t d = 0; d < sizeof(sets) / sizeof(sets[0]); d++) {
+        for (size_t z = 0; z < sizeof(sizes) / sizeof(sizes[0]); z++) {
+            size_t len = sizes[z], n = 0;
+            char name[32];
+            snprintf(name, sizeof(name), "%s%zu", sets[d].name, len);
+
+            double t0 = now_ns();
+            for (int k = 0; k < iters; k++) n = ucomms_pack(sets[d].data, len, packed, sizeof(packed));
+            double t1 = now_ns();
+            uCOMMS_VIEW v = {0};
+            for (int k = 0; k < iters; k++) CHECK(ucomms_unpack(packed, n, back, sizeof(back), &v) == 0, "ucomms_unpack()");
+            double t2 = now_ns();
+            sink += v.len;
+
+            double pack_ns = (t1 - t0) / iters;
+            report("lz", name, "ratio", (double)n / (double)len, "x");
+            report("lz", name, "pack_ns_per_byte", pack_ns / (double)len, "ns");
+            report("lz", name, "unpack_ns_per_byte", (t2 - t1) / iters / (double)len, "ns");
+            report("lz", name, "saved_us_at_9600", ((double)len - (double)n) * 10.0 / 9600.0 * 1e6, "us");
+            report("lz", name, "pack_us", pack_ns / 1e3, "us");
+        }
+    }
+}
+
+
+/// * Zero copy receive
+
+// The same stream through a pipe, read in 32 KiB pieces: read() into a
+// buffer, parse_buf() and a copy out to the consumer, against reading into a
+// uCOMMS_RX_RING and handing out views.
+void bench_rxring(void) {
+    const size_t sizes[] = {60, 256, 1000};
+    const int    escapes[] = {0, 1};
+    const size_t stream_cap = quick ? 1 << 20 : 16 << 20;
+    const size_t piece = 32 << 10;
+    uint8_t *stream = malloc(stream_cap);
+    static char    frame[uCOMMS_MAX_FRAME_PAYLOAD + 2];
+    static uint8_t app[uCOMMS_MAX_FRAME_PAYLOAD];
+    static uint8_t buf[4096];         /// ? What the engine reads per wakeup.
+    CHECK_PTR(stream);
+
+    int fds[2];
+    CHECK(pipe(fds) == 0, "pipe()");
+    CHECK(fcntl(fds[0], F_SETFL, O_NONBLOCK) == 0, "fcntl()");
+
+    uCOMMS_RX_RING rx;
+    CHECK(ucomms_rx_init(&rx, 1 << 16, 1000, uCOMMS_RX_MIRROR) == 0, "ucomms_rx_init()");
+
+    for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+        for (size_t e = 0; e < sizeof(escapes) / sizeof(escapes[0]); e++) {
+            size_t len = build_stream(stream, stream_cap, sizes[s], escapes[e], uCOMMS_CRC_NONE);
+            char name[64];
+            snprintf(name, sizeof(name), "payload%zu_esc%d", sizes[s], escapes[e]);
+
+            uCOMMS_CONTEXT ctx = {0};
+            attach_buffer(&ctx, frame, sizeof(frame));
+            uint64_t frames = 0, copied = 0, viewed = 0;
+            double t0 = now_ns();
+            for (size_t off = 0; off < len; off += piece) {
+                size_t n = len - off < piece ? len - off : piece;
+                CHECK(write(fds[1], stream + off, n) == (ssize_t)n, "write()");
+                ssize_t got;
+                while ((got = read(fds[0], buf, sizeof(buf))) > 0) {
+                    for (size_t i = 0; i < (size_t)got;) {
+                        i += parse_buf(&ctx, buf + i, (size_t)got - i);
+                        if (!frame_ready(&ctx)) continue;
+                        memcpy(app, frame_buf(&ctx), ctx.curr_cmd_len);
+                        frames += app[0];
+                        copied++;
+                    }
+                }
+            }
+            double t1 = now_ns();
+            report("rx_copy", name, "MB_per_s", (double)len / ((t1 - t0) / 1e9) / 1e6, "MB/s");
+
+            t0 = now_ns();
+            for (size_t off = 0; off < len; off += piece) {
+                size_t n = len - off < piece ? len - off : piece;
+                CHECK(write(fds[1], stream + off, n) == (ssize_t)n, "write()");
+                uCOMMS_RX_VIEW view;
+                while (ucomms_rx_read(&rx, fds[0]) > 0) {
+                    while (ucomms_rx_next(&rx, &view)) {
+                        frames += view.ptr[0];
+                        viewed++;
+                        ucomms_rx_release(&rx, &view);
+                    }
+                }
+            }
+            t1 = now_ns();
+            /// ? A row is only worth something if both sides got every frame.
+            CHECK((copied > 0 && viewed == copied && ctx.dropped_frames == 0 && rx.ctx.dropped_frames == 0), "rx_ring lost frames");
+            report("rx_ring", name, "MB_per_s", (double)len / ((t1 - t0) / 1e9) / 1e6, "MB/s");
+            sink += frames;
+        }
+    }
+    ucomms_rx_close(&rx);
+    close(fds[0]);
+    close(fds[1]);
+    free(stream);
+}
+
+
+/// * Many streams
+
+static void count_group_frame(void *user, size_t stream, const uint8_t *payload, size_t len) {
+    (void)user;
+    (void)payload;
+    sink += stream + len;
+}
+
+// A gateway's receive side: every stream gets a 256 byte chunk per round,
+// parsed by one uCOMMS_CONTEXT per stream against one uCOMMS_PARSER_GROUP.
+// Streams read the same 60 byte payload traffic from different offsets.
+void bench_group(void) {
+    const size_t counts[] = {8, 64, 512};
+    const size_t chunk = 256;
+    const size_t stream_cap = 1 << 20;
+    const size_t total = quick ? 4 << 20 : 64 << 20;
+    uint8_t *stream = malloc(stream_cap);
+    CHECK_PTR(stream);
+    size_t len = build_stream(stream, stream_cap, 60, 1, uCOMMS_CRC_NONE);
+
+    for (size_t c = 0; c < sizeof(counts) / sizeof(counts[0]); c++) {
+        size_t n = counts[c];
+        size_t rounds = total / (n * chunk);
+        char name[64];
+        snprintf(name, sizeof(name), "streams%zu", n);
+
+        const uint8_t **data = malloc(n * sizeof(*data));
+        size_t *lens = malloc(n * sizeof(*lens));
+        size_t *off  = malloc(n * sizeof(*off));
+        uCOMMS_CONTEXT *ctx = calloc(n, sizeof(*ctx));
+        void *mem = aligned_alloc(uCOMMS_GROUP_ALIGN, group_round(ucomms_group_mem_size(n, uCOMMS_CONTEXT_BUFFER_SIZE)));
+        CHECK(data && lens && off && ctx && mem, "bench_group() allocation");
+        uCOMMS_PARSER_GROUP g;
+        ucomms_group_init(&g, mem, n, uCOMMS_CONTEXT_BUFFER_SIZE, uCOMMS_CRC_NONE);
+
+        /// ? Both sides see exactly the same chunks.
+        for (size_t s = 0; s < n; s++) off[s] = (s * 4099) % (len - chunk);
+        double t0 = now_ns();
+        for (size_t r = 0; r < rounds; r++) {
+            for (size_t s = 0; s < n; s++) {
+                const uint8_t *p = stream + off[s];
+                for (size_t i = 0; i < chunk;) {
+                    i += parse_buf(&ctx[s], p + i, chunk - i);
+                    if (frame_ready(&ctx[s])) count_group_frame(NULL, s, (const uint8_t *)frame_buf(&ctx[s]), ctx[s].curr_cmd_len);
+                }
+                off[s] = off[s] + chunk > len - chunk ? 0 : off[s] + chunk;
+            }
+        }
+        double t1 = now_ns();
+        double bytes = (double)rounds * (double)n * (double)chunk;
+        report("contexts", name, "ns_per_byte", (t1 - t0) / bytes, "ns");
+        report("contexts", name, "MB_per_s", bytes / ((t1 - t0) / 1e9) / 1e6, "MB/s");
+
+        for (size_t s = 0; s < n; s++) {
+            off[s]  = (s * 4099) % (len - chunk);
+            lens[s] = chunk;
+        }
+        t0 = now_ns();
+        for (size_t r = 0; r < rounds; r++) {
+            for (size_t s = 0; s < n; s++) data[s] = stream + off[s];
+            ucomms_group_parse(&g, data, lens, count_group_frame, NULL);
+            for (size_t s = 0; s < n; s++) off[s] = off[s] + chunk > len - chunk ? 0 : off[s] + chunk;
+        }
+        t1 = now_ns();
+        report("group", name, "ns_per_byte", (t1 - t0) / bytes, "ns");
+        report("group", name, "MB_per_s", bytes / ((t1 - t0) / 1e9) / 1e6, "MB/s");
+
+        free(mem);
+        free(ctx);
+        free(off);
+        free(lens);
+        free(data);
+    }
+    free(stream);
+}
+
+
+/// * End to end over a pty pair
+
+// Device side: echoes every frame it receives until the line goes away.
+void echo_device(int fd) {
+    uCOMMS_CONTEXT ctx = {0};
+    static char buf[uCOMMS_MAX_BUFFER_SIZE];
+    attach_buffer(&ctx, buf, sizeof(buf));
+    uint8_t chunk[4096];
+    for (;;) {
+        ssize_t n = read(fd, chunk, sizeof(chunk));
+        if (n <= 0) _exit(0);
+        for (size_t off = 0; off < (size_t)n;) {
+            off += parse_buf(&ctx, chunk + off, (size_t)n - off);
+            if (frame_ready(&ctx) && ucomms_send(fd, frame_buf(&ctx), ctx.curr_cmd_len) != 0) _exit(1);
+        }
+    }
+}
+
+// Host side: waits for one echoed frame, -1 on timeout.
+int wait_frame(int fd, uCOMMS_CONTEXT *ctx, uint8_t *chunk, size_t *have, size_t *off) {
+    for (;;) {
+        while (*off < *have) {
+            *off += parse_buf(ctx, chunk + *off, *have - *off);
+            if (frame_ready(ctx)) return 0;
+        }
+        struct pollfd pfd = {.fd = fd, .events = POLLIN};
+        if (poll(&pfd, 1, 2000) <= 0) return -1;
+        ssize_t n = read(fd, chunk, 4096);
+        if (n <= 0) return -1;
+        *have = (size_t)n;
+        *off = 0;
+    }
+}
+
+int compare_doubles(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+void bench_pty(void) {
+    int master, slave;
+    CHECK(openpty(&master, &slave, NULL, NULL, NULL) == 0, "openpty()");
+    int fd = ucomms_port_open(ttyname(slave));
+    CHECK_OPEN(fd >= 0);
+    close(slave);
+
+    pid_t pid = fork();
+    CHECK(pid >= 0, "fork()");
+    if (pid == 0) {
+        close(fd);
+        echo_device(master);
+    }
+
+    uCOMMS_CONTEXT ctx = {0};
+    uint8_t chunk[4096];
+    size_t have = 0, off = 0;
+    uint8_t payload[uCOMMS_MAX_PAYLOAD];
+    memset(payload, 'x', sizeof(payload));
+
+    /// ? Round trip latency, one frame in flight.
+    const int samples = quick ? 500 : 20000;
+    double *rtt = malloc(sizeof(double) * (size_t)samples);
+    CHECK_PTR(rtt);
+    for (int i = 0; i < samples; i++) {
+        double t0 = now_ns();
+        CHECK(ucomms_send(fd, payload, 16) == 0, "ucomms_send()");
+        CHECK(wait_frame(fd, &ctx, chunk, &have, &off) == 0, "echo timed out");
+        rtt[i] = now_ns() - t0;
+    }
+    qsort(rtt, (size_t)samples, sizeof(double), compare_doubles);
+    report("pty_rtt", "payload16", "p50",   rtt[samples / 2] / 1e3, "us");
+    report("pty_rtt", "payload16", "p99",   rtt[(size_t)(samples * 0.99)] / 1e3, "us");
+    report("pty_rtt", "payload16", "p99.9", rtt[(size_t)(samples * 0.999)] / 1e3, "us");
+    free(rtt);
+
+    /// ? Throughput, a window of frames in flight at a time.
+    const size_t sizes[] = {16, 60};
+    for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+        enum { WINDOW = 32 };
+        const int rounds = quick ? 50 : 2000;
+        struct iovec frames[WINDOW];
+        for (int k = 0; k < WINDOW; k++) frames[k] = (struct iovec){payload, sizes[s]};
+
+        double t0 = now_ns();
+        for (int r = 0; r < rounds; r++) {
+            CHECK(ucomms_send_batch(fd, frames, WINDOW) == 0, "ucomms_send_batch()");
+            for (int k = 0; k < WINDOW; k++) CHECK(wait_frame(fd, &ctx, chunk, &have, &off) == 0, "echo timed out");
+        }
+        double t1 = now_ns();
+        char name[32];
+        snprintf(name, sizeof(name), "payload%zu", sizes[s]);
+        report("pty_echo", name, "frames_per_s", (double)rounds * WINDOW / ((t1 - t0) / 1e9), "frames/s");
+    }
+
+    close(fd);
+    kill(pid, SIGTERM);
+    waitpid(pid, NULL, 0);
+    close(master);
+}
+
+
+int main(int argc, char **argv) {
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--json") == 0) json_output = 1;
+        else if (strcmp(argv[i], "--quick") == 0) quick = 1;
+        else {
+            fprintf(stderr, "usage: %s [--json] [--quick]\n", argv[0]);
+            return 2;
+        }
+    }
+
+    report_begin();
+    bench_parser();
+    bench_crc();
+    bench_lz();
+    bench_rxring();
+    bench_group();
+    bench_pty();
+    report_end();
+    return 0;
+}
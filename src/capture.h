@@ -0,0 +1,200 @@
+#pragma once
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "checks.h"
+#include "stats.h"
+#include "tx.h"
+
+/// * Raw stream capture.
+/// * Every chunk read from or written to a port is appended to a log file as
+/// * is, before any parsing, so a trace can be fed through the parser again
+/// * offline (see replay.c). The log is a 16 byte header then one record per
+/// * chunk:
+/// *
+/// *     header   {"uCAP", VERSION, 3 x 0, START_NS (u64 little endian)}
+/// *     record   {STREAM << 1 | DIR, DELTA_US (varint), LEN (varint), BYTES}
+/// *
+/// * STREAM tells up to 128 ports sharing a log apart.
+/// * DELTA_US is the time since the previous record (since START_NS for the
+/// * first one), on CLOCK_MONOTONIC. Varints are LEB128, like MSG_LEN.
+
+#define uCOMMS_CAPTURE_MAGIC    "uCAP"
+#define uCOMMS_CAPTURE_VERSION  1
+#define uCOMMS_CAPTURE_HEADER   16
+#define uCOMMS_CAPTURE_STREAMS  128
+
+typedef enum {
+    uCOMMS_CAPTURE_RX = 0,
+    uCOMMS_CAPTURE_TX = 1,
+} uCOMMS_CAPTURE_DIR;
+
+typedef struct {
+    int      fd;
+    uint64_t start_ns;
+    uint64_t last_us;        /// ? Timestamp of the last record, since start_ns.
+    uint64_t records;
+} uCOMMS_CAPTURE;
+
+typedef struct {
+    uint8_t        dir;      /// ? uCOMMS_CAPTURE_DIR.
+    uint8_t        stream;
+    uint64_t       time_us;  /// ? Since the start of the capture.
+    const uint8_t *data;     /// ? Points into the mapping.
+    size_t         len;
+} uCOMMS_CAPTURE_RECORD;
+
+typedef struct {
+    const uint8_t *map;
+    size_t         size;
+    size_t         off;
+    uint64_t       start_ns;
+    uint64_t       time_us;
+} uCOMMS_CAPTURE_READER;
+
+// Writes v as a LEB128 varint, up to 10 bytes, returns the number of bytes.
+size_t capture_varint(uint64_t v, uint8_t *out) {
+    size_t n = 0;
+    while (v >= 0x80) {
+        out[n++] = (uint8_t)(v | 0x80);
+        v >>= 7;
+    }
+    out[n++] = (uint8_t)v;
+    return n;
+}
+
+// Reads a varint at *off, returns 0 or -1 if it runs off the end.
+int capture_read_varint(const uint8_t *p, size_t size, size_t *off, uint64_t *v) {
+    *v = 0;
+    for (unsigned shift = 0; *off < size && shift < 64; shift += 7) {
+        uint8_t b = p[(*off)++];
+        *v |= (uint64_t)(b & 0x7F) << shift;
+        if (!(b & 0x80)) return 0;
+    }
+    return -1;
+}
+
+// Creates (or truncates) a capture log. Returns 0, or -1 with errno set.
+int ucomms_capture_open(uCOMMS_CAPTURE *cap, const char *path) {
+    CHECK_PTR(cap);
+    CHECK_PTR(path);
+    memset(cap, 0, sizeof(*cap));
+    cap->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC, 0644);
+    if (cap->fd < 0) return -1;
+
+    cap->start_ns = ucomms_now_ns();
+    uint8_t hdr[uCOMMS_CAPTURE_HEADER] = {'u', 'C', 'A', 'P', uCOMMS_CAPTURE_VERSION};
+    for (int i = 0; i < 8; i++) hdr[8 + i] = (uint8_t)(cap->start_ns >> (8 * i));
+    if (write(cap->fd, hdr, sizeof(hdr)) != (ssize_t)sizeof(hdr)) {
+        int err = errno;
+        close(cap->fd);
+        cap->fd = -1;
+        errno = err;
+        return -1;
+    }
+    return 0;
+}
+
+// Appends one chunk of a stream (0 to 127). Returns 0, or -1 with errno set.
+int ucomms_capture_append(uCOMMS_CAPTURE *cap, uint8_t stream, uCOMMS_CAPTURE_DIR dir, const void *data, size_t len) {
+    CHECK_PTR(cap);
+    CHECK((stream < uCOMMS_CAPTURE_STREAMS), "ucomms_capture_append() stream");
+    if (len) CHECK_PTR(data);
+
+    uint64_t now_us = (ucomms_now_ns() - cap->start_ns) / 1000u;
+    uint8_t  hdr[1 + 10 + 10];
+    size_t   n = 0;
+    hdr[n++] = (uint8_t)(stream << 1 | dir);
+    n += capture_varint(now_us - cap->last_us, hdr + n);
+    n += capture_varint(len, hdr + n);
+    cap->last_us = now_us;
+    cap->records++;
+
+    struct iovec iov[2] = {{hdr, n}, {(void *)data, len}};
+    return writev_all(cap->fd, iov, len ? 2 : 1);
+}
+
+// Closes the log. Returns 0, or -1 with errno set.
+int ucomms_capture_close(uCOMMS_CAPTURE *cap) {
+    CHECK_PTR(cap);
+    int rc = cap->fd >= 0 ? close(cap->fd) : 0;
+    cap->fd = -1;
+    return rc;
+}
+
+// Maps a capture log for reading. Returns 0, or -1 with errno set (EINVAL
+// when it is not a capture log).
+int ucomms_capture_map(uCOMMS_CAPTURE_READER *rd, const char *path) {
+    CHECK_PTR(rd);
+    CHECK_PTR(path);
+    memset(rd, 0, sizeof(*rd));
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return -1;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        int err = errno;
+        close(fd);
+        errno = err;
+        return -1;
+    }
+    if ((size_t)st.st_size < uCOMMS_CAPTURE_HEADER) {
+        close(fd);
+        errno = EINVAL;
+        return -1;
+    }
+
+    void *map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) return -1;
+    madvise(map, (size_t)st.st_size, MADV_SEQUENTIAL);
+
+    rd->map  = map;
+    rd->size = (size_t)st.st_size;
+    rd->off  = uCOMMS_CAPTURE_HEADER;
+    if (memcmp(rd->map, uCOMMS_CAPTURE_MAGIC, 4) != 0 || rd->map[4] != uCOMMS_CAPTURE_VERSION) {
+        munmap(map, rd->size);
+        rd->map = NULL;
+        errno = EINVAL;
+        return -1;
+    }
+    for (int i = 0; i < 8; i++) rd->start_ns |= (uint64_t)rd->map[8 + i] << (8 * i);
+    return 0;
+}
+
+// Reads the next record. Returns 1, 0 at the end of the log, or -1 if the
+// log is cut short or corrupt.
+int ucomms_capture_next(uCOMMS_CAPTURE_READER *rd, uCOMMS_CAPTURE_RECORD *rec) {
+    CHECK_PTR(rd);
+    CHECK_PTR(rec);
+    if (rd->off == rd->size) return 0;
+
+    uint64_t delta, len;
+    rec->dir    = rd->map[rd->off] & 1;
+    rec->stream = rd->map[rd->off++] >> 1;
+    if (capture_read_varint(rd->map, rd->size, &rd->off, &delta) < 0) return -1;
+    if (capture_read_varint(rd->map, rd->size, &rd->off, &len) < 0) return -1;
+    if (len > rd->size - rd->off) return -1;
+
+    rd->time_us  += delta;
+    rec->time_us  = rd->time_us;
+    rec->data     = rd->map + rd->off;
+    rec->len      = (size_t)len;
+    rd->off      += (size_t)len;
+    return 1;
+}
+
+// Unmaps a log.
+void ucomms_capture_unmap(uCOMMS_CAPTURE_READER *rd) {
+    CHECK_PTR(rd);
+    if (rd->map) munmap((void *)rd->map, rd->size);
+    rd->map = NULL;
+}
@@ -0,0 +1,119 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <threads.h>     /// call_once() for the lookup tables
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+/// * Frame check sequences.
+/// * CRC-16/CCITT-FALSE (poly 0x1021, init 0xFFFF) for small targets and
+/// * CRC-32C (Castagnoli, the one SSE4.2 has an instruction for) for hosts.
+/// * Both are updated incrementally: crc_begin(), crc_update() on every run of
+/// * bytes as it is parsed, crc_final() once the frame is complete.
+/// * CRC-32C uses slice-by-8 tables, or the crc32 instruction when the CPU has it.
+
+typedef enum {
+    uCOMMS_CRC_NONE   = 0,
+    uCOMMS_CRC16      = 1,   /// ? 2 byte trailer.
+    uCOMMS_CRC32C     = 2,   /// ? 4 byte trailer.
+} uCOMMS_CRC_MODE;
+
+static uint16_t  crc16_table[256];
+static uint32_t  crc32c_table[8][256];
+static once_flag crc_tables_once = ONCE_FLAG_INIT;
+static int       crc32c_hw;
+
+void crc_tables_init(void) {
+    for (uint32_t i = 0; i < 256; i++) {
+        uint16_t c16 = (uint16_t)(i << 8);
+        uint32_t c32 = i;
+        for (int k = 0; k < 8; k++) {
+            c16 = (c16 & 0x8000) ? (uint16_t)((c16 << 1) ^ 0x1021) : (uint16_t)(c16 << 1);
+            c32 = (c32 & 1) ? (c32 >> 1) ^ 0x82F63B78u : c32 >> 1;
+        }
+        crc16_table[i] = c16;
+        crc32c_table[0][i] = c32;
+    }
+    /// ? Slice k is the CRC of a byte followed by k zero bytes.
+    for (uint32_t i = 0; i < 256; i++) {
+        for (int k = 1; k < 8; k++) {
+            uint32_t prev = crc32c_table[k - 1][i];
+            crc32c_table[k][i] = (prev >> 8) ^ crc32c_table[0][prev & 0xFF];
+        }
+    }
+#if defined(__x86_64__)
+    crc32c_hw = __builtin_cpu_supports("sse4.2");
+#endif
+}
+
+// Returns the trailer size for a mode.
+size_t crc_size(uint8_t mode) {
+    return mode == uCOMMS_CRC16 ? 2 : (mode == uCOMMS_CRC32C ? 4 : 0);
+}
+
+uint16_t crc16_update(uint16_t crc, const uint8_t *p, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        crc = (uint16_t)((crc << 8) ^ crc16_table[(crc >> 8) ^ p[i]]);
+    }
+    return crc;
+}
+
+uint32_t crc32c_update_sw(uint32_t crc, const uint8_t *p, size_t n) {
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    for (; n >= 8; n -= 8, p += 8) {
+        uint64_t v;
+        memcpy(&v, p, sizeof(v));
+        v ^= crc;
+        crc = crc32c_table[7][v & 0xFF]         ^ crc32c_table[6][(v >> 8) & 0xFF]
+            ^ crc32c_table[5][(v >> 16) & 0xFF] ^ crc32c_table[4][(v >> 24) & 0xFF]
+            ^ crc32c_table[3][(v >> 32) & 0xFF] ^ crc32c_table[2][(v >> 40) & 0xFF]
+            ^ crc32c_table[1][(v >> 48) & 0xFF] ^ crc32c_table[0][v >> 56];
+    }
+#endif
+    for (; n; n--, p++) crc = (crc >> 8) ^ crc32c_table[0][(crc ^ *p) & 0xFF];
+    return crc;
+}
+
+#if defined(__x86_64__)
+__attribute__((target("sse4.2")))
+uint32_t crc32c_update_hw(uint32_t crc, const uint8_t *p, size_t n) {
+    uint64_t c = crc;
+    for (; n >= 8; n -= 8, p += 8) {
+        uint64_t v;
+        memcpy(&v, p, sizeof(v));
+        c = _mm_crc32_u64(c, v);
+    }
+    for (; n; n--, p++) c = _mm_crc32_u8((uint32_t)c, *p);
+    return (uint32_t)c;
+}
+#endif
+
+// Starts a CRC, also makes sure the tables exist.
+uint32_t crc_begin(uint8_t mode) {
+    call_once(&crc_tables_once, crc_tables_init);
+    return mode == uCOMMS_CRC16 ? 0xFFFF : 0xFFFFFFFFu;
+}
+
+// Feeds n more bytes into a running CRC.
+uint32_t crc_update(uint8_t mode, uint32_t crc, const uint8_t *p, size_t n) {
+    if (mode == uCOMMS_CRC_NONE) return crc;
+    if (mode == uCOMMS_CRC16) return crc16_update((uint16_t)crc, p, n);
+#if defined(__x86_64__)
+    if (crc32c_hw) return crc32c_update_hw(crc, p, n);
+#endif
+    return crc32c_update_sw(crc, p, n);
+}
+
+// Returns the value that goes on the wire, little endian, crc_size() bytes.
+uint32_t crc_final(uint8_t mode, uint32_t crc) {
+    return mode == uCOMMS_CRC16 ? (crc & 0xFFFF) : ~crc;
+}
+
+// One shot CRC of a buffer.
+uint32_t crc_compute(uint8_t mode, const uint8_t *p, size_t n) {
+    return crc_final(mode, crc_update(mode, crc_begin(mode), p, n));
+}
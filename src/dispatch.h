@@ -0,0 +1,165 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "checks.h"
+
+/// * Command dispatch table behind interprete_cmd().
+/// * A command is looked up by its key: everything up to and including the
+/// * first ':' ("GET:FR" -> "GET:"), or the whole payload when there is none
+/// * ("TOGGLE"). The rest is handed to the handler as the arguments.
+/// * dispatch_build() turns the registered keys into a two level perfect hash
+/// * (hash and displace), so a lookup is two hashes and one memcmp no matter
+/// * how many commands there are.
+
+#define uCOMMS_MAX_CMDS          512    /// ? Commands per table.
+#define uCOMMS_DISPATCH_SLOTS    1024   /// ? Second level slots, power of two.
+#define uCOMMS_DISPATCH_BUCKETS  256    /// ? First level buckets, power of two.
+#define uCOMMS_DISPATCH_MAX_SEED 0xFFFF
+
+/// ? Pointer/length view into a received frame, valid during the handler call.
+typedef struct {
+    const char *ptr;
+    size_t      len;
+} uCOMMS_VIEW;
+
+typedef void (*uCOMMS_CMD_HANDLER)(uCOMMS_VIEW cmd, uCOMMS_VIEW args, void *user);
+
+typedef struct {
+    const char        *key;       /// ? Not copied, must outlive the table.
+    uint8_t            key_len;
+    uCOMMS_CMD_HANDLER handler;
+    void              *user;
+} uCOMMS_CMD;
+
+typedef struct {
+    uCOMMS_CMD cmds[uCOMMS_MAX_CMDS];
+    uint16_t   count;
+    uint16_t   seeds[uCOMMS_DISPATCH_BUCKETS];   /// ? Displacement per bucket.
+    uint16_t   slots[uCOMMS_DISPATCH_SLOTS];     /// ? Command index + 1, 0 is empty.
+    uint8_t    built;
+} uCOMMS_DISPATCH;
+
+// Seeded FNV-1a with a final avalanche, seed 0 picks the bucket.
+uint32_t dispatch_hash(const char *key, size_t len, uint32_t seed) {
+    uint32_t h = 2166136261u ^ (seed * 0x9E3779B1u);
+    for (size_t i = 0; i < len; i++) {
+        h ^= (uint8_t)key[i];
+        h *= 16777619u;
+    }
+    h ^= h >> 16;
+    h *= 0x85EBCA6Bu;
+    h ^= h >> 13;
+    return h;
+}
+
+// Returns the length of the dispatch key at the start of a command.
+size_t dispatch_key_len(const char *cmd, size_t len) {
+    const char *colon = memchr(cmd, ':', len);
+    return colon ? (size_t)(colon - cmd) + 1 : len;
+}
+
+// Clears a table.
+void dispatch_init(uCOMMS_DISPATCH *d) {
+    CHECK_PTR(d);
+    memset(d, 0, sizeof(*d));
+}
+
+// Adds a command, "NAME" or "PREFIX:". Call dispatch_build() once all are in.
+// Returns 0, or -1 if the table is full, the key is a duplicate or invalid.
+int dispatch_register(uCOMMS_DISPATCH *d, const char *key, uCOMMS_CMD_HANDLER handler, void *user) {
+    CHECK_PTR(d);
+    CHECK_PTR(key);
+    CHECK_PTR(handler);
+
+    size_t len = strlen(key);
+    if (len == 0 || len > UINT8_MAX || dispatch_key_len(key, len) != len) return -1;
+    if (d->count == uCOMMS_MAX_CMDS) return -1;
+    for (uint16_t i = 0; i < d->count; i++) {
+        if (d->cmds[i].key_len == len && memcmp(d->cmds[i].key, key, len) == 0) return -1;
+    }
+
+    d->cmds[d->count++] = (uCOMMS_CMD){.key = key, .key_len = (uint8_t)len, .handler = handler, .user = user};
+    d->built = 0;
+    return 0;
+}
+
+// Builds the perfect hash over every registered command.
+// Returns 0, or -1 if no displacement worked for some bucket.
+int dispatch_build(uCOMMS_DISPATCH *d) {
+    CHECK_PTR(d);
+    memset(d->seeds, 0, sizeof(d->seeds));
+    memset(d->slots, 0, sizeof(d->slots));
+
+    /// ? Commands grouped by bucket, kept as linked lists in a flat array.
+    uint16_t next[uCOMMS_MAX_CMDS];
+    uint16_t head[uCOMMS_DISPATCH_BUCKETS];
+    uint16_t size[uCOMMS_DISPATCH_BUCKETS] = {0};
+    memset(head, 0xFF, sizeof(head));
+    for (uint16_t i = 0; i < d->count; i++) {
+        uint16_t b = dispatch_hash(d->cmds[i].key, d->cmds[i].key_len, 0) & (uCOMMS_DISPATCH_BUCKETS - 1);
+        next[i] = head[b];
+        head[b] = i;
+        size[b]++;
+    }
+
+    /// ? Biggest buckets first, while the table is still empty.
+    for (uint16_t want = uCOMMS_MAX_CMDS; want > 0; want--) {
+        for (uint16_t b = 0; b < uCOMMS_DISPATCH_BUCKETS; b++) {
+            if (size[b] != want) continue;
+
+            uint32_t seed;
+            for (seed = 1; seed <= uCOMMS_DISPATCH_MAX_SEED; seed++) {
+                uint16_t taken[uCOMMS_MAX_CMDS];
+                uint16_t n = 0;
+                int ok = 1;
+                for (uint16_t i = head[b]; i != 0xFFFF && ok; i = next[i]) {
+                    uint16_t s = dispatch_hash(d->cmds[i].key, d->cmds[i].key_len, seed) & (uCOMMS_DISPATCH_SLOTS - 1);
+                    if (d->slots[s]) ok = 0;
+                    for (uint16_t k = 0; k < n && ok; k++) ok = taken[k] != s;
+                    taken[n++] = s;
+                }
+                if (ok) break;
+            }
+            if (seed > uCOMMS_DISPATCH_MAX_SEED) return -1;
+
+            d->seeds[b] = (uint16_t)seed;
+            for (uint16_t i = head[b]; i != 0xFFFF; i = next[i]) {
+                uint16_t s = dispatch_hash(d->cmds[i].key, d->cmds[i].key_len, seed) & (uCOMMS_DISPATCH_SLOTS - 1);
+                d->slots[s] = i + 1;
+            }
+        }
+    }
+
+    d->built = 1;
+    return 0;
+}
+
+// Looks a command up, NULL if it is not registered.
+const uCOMMS_CMD *dispatch_find(const uCOMMS_DISPATCH *d, const char *key, size_t len) {
+    uint32_t b = dispatch_hash(key, len, 0) & (uCOMMS_DISPATCH_BUCKETS - 1);
+    uint32_t s = dispatch_hash(key, len, d->seeds[b]) & (uCOMMS_DISPATCH_SLOTS - 1);
+    uint16_t idx = d->slots[s];
+    if (!idx) return NULL;
+
+    const uCOMMS_CMD *c = &d->cmds[idx - 1];
+    return (c->key_len == len && memcmp(c->key, key, len) == 0) ? c : NULL;
+}
+
+// Runs the handler for a command, cmd points into the received frame.
+// Returns 1 if a handler ran, 0 for an unknown command.
+int dispatch_cmd(const uCOMMS_DISPATCH *d, const char *cmd, size_t len) {
+    CHECK_PTR(d);
+    CHECK(d->built, "dispatch_build() not called");
+
+    size_t key_len = dispatch_key_len(cmd, len);
+    const uCOMMS_CMD *c = dispatch_find(d, cmd, key_len);
+    if (!c) return 0;
+
+    uCOMMS_VIEW whole = {cmd, len};
+    uCOMMS_VIEW args  = {cmd + key_len, len - key_len};
+    c->handler(whole, args, c->user);
+    return 1;
+}
@@ -0,0 +1,234 @@
+#pragma once
+
+#include <errno.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/epoll.h>
+#include <unistd.h>
+
+#include "checks.h"
+#include "ucoms.h"
+#include "txq.h"
+
+/// * Event loop for many serial ports on one thread.
+/// * Every port is a non-blocking fd with its own uCOMMS_CONTEXT, epoll tells
+/// * us which ones have data, each wakeup reads one chunk and runs parse_buf()
+/// * over it. Decoded frames go to the port's handler as a view into frame_buf(),
+/// * valid until the handler returns.
+/// * Frames sent with ucomms_port_send() are coalesced in the port's uCOMMS_TXQ,
+/// * the loop wakes up in time to flush them, tune the limits on port->txq.
+/// * A port that does not take its frames right away (a full buffer, RTS/CTS
+/// * holding it off) gets EPOLLOUT armed until it has, the other ports are
+/// * serviced in the meantime. The queue is the only writer of the fd, so
+/// * frames never land in the middle of each other. Other senders on a port,
+/// * like a uCOMMS_MUX, queue through port->txq and hook in with
+/// * ucomms_port_writable() to top it up as it drains.
+
+#define uCOMMS_MAX_PORTS   64      /// ? Ports per engine.
+#define uCOMMS_READ_CHUNK  4096    /// ? Bytes read per wakeup.
+#define uCOMMS_MAX_EVENTS  64      /// ? Events collected per epoll_wait().
+
+struct uCOMMS_PORT;
+typedef void (*uCOMMS_FRAME_HANDLER)(struct uCOMMS_PORT *port, const uint8_t *payload, size_t len);
+/// ? Sends what it can without blocking, returns 1 while it has more to send.
+typedef int (*uCOMMS_WRITABLE_HANDLER)(void *user);
+
+typedef struct uCOMMS_PORT {
+    int                  fd;          /// ? -1 when the slot is free.
+    uCOMMS_CONTEXT       ctx;         /// ? Parser state for this port only.
+    uCOMMS_FRAME_HANDLER on_frame;
+    void                *user;        /// ? Handler data, not touched by the engine.
+    uCOMMS_CAPTURE      *capture;     /// ? Raw RX/TX log, see ucomms_port_capture().
+    uint8_t              capture_stream;
+    uCOMMS_STATS         stats;       /// ? Link statistics, fed by ctx and txq.
+    uCOMMS_WRITABLE_HANDLER on_writable;   /// ? Extra sender, see ucomms_port_writable().
+    void                *writable_user;
+    uint8_t              write_more;  /// ? on_writable has more to send.
+    uint8_t              writing;     /// ? EPOLLOUT armed, see engine_arm().
+    uCOMMS_TXQ           txq;         /// ? Outgoing frames, see ucomms_port_send().
+} uCOMMS_PORT;
+
+typedef struct {
+    int         epfd;
+    size_t      count;                /// ? Ports currently registered.
+    uCOMMS_PORT ports[uCOMMS_MAX_PORTS];
+} uCOMMS_ENGINE;
+
+// Sets up an empty engine. Returns 0, or -1 with errno set.
+int ucomms_engine_init(uCOMMS_ENGINE *eng) {
+    CHECK_PTR(eng);
+    memset(eng, 0, sizeof(*eng));
+    for (size_t i = 0; i < uCOMMS_MAX_PORTS; i++) eng->ports[i].fd = -1;
+    eng->epfd = epoll_create1(EPOLL_CLOEXEC);
+    return eng->epfd < 0 ? -1 : 0;
+}
+
+// Registers a non-blocking fd, see ucomms_port_open().
+// Returns the port, or NULL with errno set (ENOSPC when the engine is full).
+uCOMMS_PORT *ucomms_engine_add_port(uCOMMS_ENGINE *eng, int fd, uCOMMS_FRAME_HANDLER on_frame, void *user) {
+    CHECK_PTR(eng);
+    CHECK_PTR(on_frame);
+
+    uCOMMS_PORT *port = NULL;
+    for (size_t i = 0; i < uCOMMS_MAX_PORTS && !port; i++) {
+        if (eng->ports[i].fd < 0) port = &eng->ports[i];
+    }
+    if (!port) {
+        errno = ENOSPC;
+        return NULL;
+    }
+
+    struct epoll_event ev = {.events = EPOLLIN, .data.ptr = port};
+    if (epoll_ctl(eng->epfd, EPOLL_CTL_ADD, fd, &ev) != 0) return NULL;
+
+    memset(port, 0, offsetof(uCOMMS_PORT, txq));
+    ucomms_txq_init(&port->txq, fd, uCOMMS_CRC_NONE);
+    port->ctx.stats = &port->stats;
+    port->txq.stats = &port->stats;
+    port->fd       = fd;
+    port->on_frame = on_frame;
+    port->user     = user;
+    eng->count++;
+    return port;
+}
+
+// Unregisters a port, the fd is left open for the caller.
+// Queued frames get one last flush, whatever the port does not take right
+// away is lost.
+void ucomms_engine_remove_port(uCOMMS_ENGINE *eng, uCOMMS_PORT *port) {
+    CHECK_PTR(eng);
+    CHECK_PTR(port);
+    if (port->fd < 0) return;
+    txq_flush(&port->txq, uCOMMS_FLUSH_MANUAL);
+    ucomms_txq_close(&port->txq);
+    epoll_ctl(eng->epfd, EPOLL_CTL_DEL, port->fd, NULL);
+    port->fd = -1;
+    eng->count--;
+}
+
+// Queues a frame on a port, see ucomms_txq_send(). flags is uCOMMS_TX_FLAGS.
+// Returns 0, or -1 with errno set.
+int ucomms_port_send(uCOMMS_PORT *port, const void *payload, size_t len, int flags) {
+    CHECK_PTR(port);
+    return ucomms_txq_send(&port->txq, payload, len, flags);
+}
+
+// Logs everything the port reads and sends through its queue as one stream
+// of cap, ports can share a log. NULL stops.
+void ucomms_port_capture(uCOMMS_PORT *port, uCOMMS_CAPTURE *cap, uint8_t stream) {
+    CHECK_PTR(port);
+    port->capture            = cap;
+    port->capture_stream     = stream;
+    port->txq.capture        = cap;
+    port->txq.capture_stream = stream;
+}
+
+// Watches a port for EPOLLOUT while its queue has bytes the port has not
+// taken or its on_writable hook has more to send, and stops after. Returns 0, or -1 with errno set.
+int engine_arm(uCOMMS_ENGINE *eng, uCOMMS_PORT *port) {
+    uint8_t want = ucomms_txq_pending(&port->txq) != 0 || port->write_more;
+    if (want == port->writing) return 0;
+    struct epoll_event ev = {.events = EPOLLIN | (want ? EPOLLOUT : 0), .data.ptr = port};
+    if (epoll_ctl(eng->epfd, EPOLL_CTL_MOD, port->fd, &ev) != 0) return -1;
+    port->writing = want;
+    return 0;
+}
+
+// Hooks another sender into the port, e.g. ucomms_mux_on_writable() with its
+// mux as user. The engine calls it every round and whenever the port turns
+// writable while it still has more to send. It must send through port->txq,
+// never write the fd itself. NULL unhooks.
+void ucomms_port_writable(uCOMMS_PORT *port, uCOMMS_WRITABLE_HANDLER on_writable, void *user) {
+    CHECK_PTR(port);
+    port->on_writable   = on_writable;
+    port->writable_user = user;
+    port->write_more    = 0;
+}
+
+// Reads one chunk from a port and dispatches every frame in it.
+// Returns the number of frames, or -1 once the port has hung up.
+int ucomms_port_service(uCOMMS_PORT *port) {
+    uint8_t buf[uCOMMS_READ_CHUNK];
+    ssize_t n = read(port->fd, buf, sizeof(buf));
+    if (n < 0) return (errno == EAGAIN || errno == EINTR) ? 0 : -1;
+    if (n == 0) return -1;
+    if (port->capture) ucomms_capture_append(port->capture, port->capture_stream, uCOMMS_CAPTURE_RX, buf, (size_t)n);
+
+    int frames = 0;
+    const uint8_t *p = buf;
+    size_t left = (size_t)n;
+    while (left) {
+        uint64_t t0 = ucomms_now_ns();
+        size_t used = parse_buf(&port->ctx, p, left);
+        p += used;
+        left -= used;
+        if (frame_ready(&port->ctx)) {
+            hist_record(&port->stats.parse_ns, ucomms_now_ns() - t0);
+            port->on_frame(port, (const uint8_t *)frame_buf(&port->ctx), port->ctx.curr_cmd_len);
+            frames++;
+        }
+    }
+    return frames;
+}
+
+// Waits up to timeout_ms (-1 forever) and services every ready port.
+// Returns early when a transmit queue is due, see ucomms_txq_timeout_ms().
+// A port that hangs up is removed and its fd closed.
+// Returns the number of frames dispatched, or -1 with errno set.
+int ucomms_engine_poll(uCOMMS_ENGINE *eng, int timeout_ms) {
+    CHECK_PTR(eng);
+    for (size_t i = 0; i < uCOMMS_MAX_PORTS; i++) {
+        uCOMMS_PORT *port = &eng->ports[i];
+        if (port->fd < 0) continue;
+        /// ? Frames sent since the last round may have left bytes behind.
+        if (port->on_writable) port->write_more = port->on_writable(port->writable_user) > 0;
+        engine_arm(eng, port);
+        int due = ucomms_txq_timeout_ms(&port->txq);
+        if (due >= 0 && (timeout_ms < 0 || due < timeout_ms)) timeout_ms = due;
+    }
+
+    struct epoll_event events[uCOMMS_MAX_EVENTS];
+    int ready = epoll_wait(eng->epfd, events, uCOMMS_MAX_EVENTS, timeout_ms);
+    if (ready < 0) return errno == EINTR ? 0 : -1;
+
+    int frames = 0;
+    for (int i = 0; i < ready; i++) {
+        uCOMMS_PORT *port = events[i].data.ptr;
+        if (port->fd < 0) continue;    /// ? Removed by a handler earlier in this batch.
+
+        if (events[i].events & EPOLLOUT) {
+            ucomms_txq_resume(&port->txq);
+            if (port->on_writable) port->write_more = port->on_writable(port->writable_user) > 0;
+        }
+
+        /// ? Drain what is left before honouring a hangup.
+        uint32_t ev = events[i].events;
+        int got = (ev & EPOLLIN) ? ucomms_port_service(port) : (ev & (EPOLLHUP | EPOLLERR)) ? -1 : 0;
+        if (got < 0) {
+            int fd = port->fd;
+            ucomms_engine_remove_port(eng, port);
+            close(fd);
+            continue;
+        }
+        frames += got;
+    }
+
+    /// ? A port whose queue cannot be written is left for the read side to reap.
+    for (size_t i = 0; i < uCOMMS_MAX_PORTS; i++) {
+        if (eng->ports[i].fd < 0) continue;
+        ucomms_txq_poll(&eng->ports[i].txq);
+        engine_arm(eng, &eng->ports[i]);
+    }
+    return frames;
+}
+
+// Closes the epoll instance, registered port fds are left open and their
+// queued frames dropped.
+void ucomms_engine_close(uCOMMS_ENGINE *eng) {
+    CHECK_PTR(eng);
+    for (size_t i = 0; i < uCOMMS_MAX_PORTS; i++) {
+        if (eng->ports[i].fd >= 0) ucomms_txq_close(&eng->ports[i].txq);
+    }
+    if (eng->epfd >= 0) close(eng->epfd);
+    eng->epfd = -1;
+}
@@ -0,0 +1,115 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "checks.h"
+#include "scan.h"
+#include "crc.h"
+#include "ucoms.h"
+
+/// * Frame encoder, the transmit side of parse_cmd().
+/// * {START_BYTE, MSG_LEN, COMMAND, STOP_BYTE}, with every reserved byte in
+/// * MSG_LEN and COMMAND escaped as {ESC_BYTE, byte ^ uCOMMS_ESC_XOR}.
+/// * MSG_LEN is a varint, so frames up to 64 bytes look exactly as they always did.
+
+/// ? Largest payload a context with the embedded buffer accepts.
+#define uCOMMS_MAX_PAYLOAD (uCOMMS_CONTEXT_BUFFER_SIZE - 2)
+
+/// ? Largest payload any context accepts, with a uCOMMS_MAX_BUFFER_SIZE buffer.
+#define uCOMMS_MAX_FRAME_PAYLOAD (uCOMMS_MAX_BUFFER_SIZE - 2)
+
+/// ? Worst case encoded size, every length, payload and CRC byte escaped.
+#define uCOMMS_ENCODED_MAX(len) (16 + 2 * (size_t)(len))
+
+// Returns 1 if the payload can go on the wire unchanged.
+int payload_is_clean(const uint8_t *payload, size_t len) {
+    return ucomms_find_special(payload, len) == len;
+}
+
+// Escapes src into dst, returns the number of bytes written.
+// dst needs room for 2 * len bytes in the worst case.
+size_t escape_bytes(const uint8_t *src, size_t len, uint8_t *dst) {
+    size_t in = 0, out = 0;
+    for (;;) {
+        /// ? Clean runs are copied as is, a clean payload is a single memcpy.
+        size_t run = ucomms_find_special(src + in, len - in);
+        memcpy(dst + out, src + in, run);
+        in  += run;
+        out += run;
+        if (in == len) return out;
+
+        dst[out++] = ESC_BYTE;
+        dst[out++] = src[in++] ^ uCOMMS_ESC_XOR;
+    }
+}
+
+// Writes len as a 1 to 3 byte varint, returns the number of bytes.
+size_t varint_encode(size_t len, uint8_t *out) {
+    size_t n = 0;
+    while (len >= 0x80) {
+        out[n++] = (uint8_t)(len | 0x80);
+        len >>= 7;
+    }
+    out[n++] = (uint8_t)len;
+    return n;
+}
+
+// Writes the escaped MSG_LEN field, up to 6 bytes, returns its size.
+size_t encode_length(size_t len, uint8_t *out) {
+    uint8_t raw[3];
+    return escape_bytes(raw, varint_encode(len, raw), out);
+}
+
+// Returns the exact encoded size of a frame carrying this payload.
+size_t encoded_size(const uint8_t *payload, size_t len) {
+    uint8_t len_field[6];
+    size_t n = 2 + encode_length(len, len_field) + len;
+    for (size_t i = ucomms_find_special(payload, len); i < len;
+         i += 1 + ucomms_find_special(payload + i + 1, len - i - 1)) {
+        n++;
+    }
+    return n;
+}
+
+// CRC trailer for a frame, little endian and escaped, returns its size.
+// out needs room for 2 * crc_size(mode) bytes.
+size_t encode_crc_trailer(uint8_t mode, const uint8_t *payload, size_t len, uint8_t *out) {
+    uint8_t  raw_len[3];
+    uint32_t crc = crc_update(mode, crc_begin(mode), raw_len, varint_encode(len, raw_len));
+    crc = crc_final(mode, crc_update(mode, crc, payload, len));
+
+    uint8_t raw[4];
+    for (size_t i = 0; i < crc_size(mode); i++) raw[i] = (uint8_t)(crc >> (8 * i));
+    return escape_bytes(raw, crc_size(mode), out);
+}
+
+// Encodes one frame with a CRC trailer (uCOMMS_CRC_NONE for none) into out.
+// Returns the frame size, or 0 if the payload is too big or out is too small.
+size_t encode_frame_crc(uint8_t crc_mode, const uint8_t *payload, size_t len, uint8_t *out, size_t cap) {
+    CHECK_PTR(out);
+    if (len > uCOMMS_MAX_FRAME_PAYLOAD) return 0;
+    if (len) CHECK_PTR(payload);
+
+    uint8_t trailer[8];
+    size_t  trailer_len = crc_mode ? encode_crc_trailer(crc_mode, payload, len, trailer) : 0;
+
+    /// ? Only walk the payload twice when the worst case does not fit.
+    if (cap < uCOMMS_ENCODED_MAX(len) && cap < encoded_size(payload, len) + trailer_len) return 0;
+
+    size_t n = 0;
+    out[n++] = START_BYTE;
+    n += encode_length(len, out + n);
+    n += escape_bytes(payload, len, out + n);
+    memcpy(out + n, trailer, trailer_len);
+    n += trailer_len;
+    out[n++] = STOP_BYTE;
+    return n;
+}
+
+// Encodes one frame without a CRC into out.
+// Returns the frame size, or 0 if the payload is too big or out is too small.
+size_t encode_frame(const uint8_t *payload, size_t len, uint8_t *out, size_t cap) {
+    return encode_frame_crc(uCOMMS_CRC_NONE, payload, len, out, cap);
+}
@@ -0,0 +1,156 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "checks.h"
+#include "ucoms.h"
+
+/// * Parser group for many streams.
+/// * A gateway with dozens of links would otherwise keep one uCOMMS_CONTEXT
+/// * per link, each a 64 byte buffer with the state scattered around it. The
+/// * group keeps the same state as struct of arrays instead: flags, lengths
+/// * and cursors of all streams packed next to each other, and every frame
+/// * buffer in one slab.
+/// * ucomms_group_parse() is a plain loop over the streams, one after the
+/// * other. Each stream's state is copied into a context on the stack for its
+/// * whole chunk and run through the same parse_run() and parse_byte() as
+/// * parse_buf(), so frames and errors are exactly the ones a context would
+/// * produce (uCOMMS_FATAL_PARSE_ERRORS included). Frames go to the slab, so
+/// * unlike a context the group does not clear comms_buf for every frame.
+/// * Beyond that the gain is memory: the state of all streams sits in a few
+/// * contiguous cache lines instead of one context each. Expect roughly the
+/// * speed of a context per stream, not a multiple of it. All streams share
+/// * one crc_mode. Like pool.h
+/// * the caller provides the memory, see ucomms_group_mem_size().
+
+/// ? payload is in the stream's slot of the slab, valid until the handler returns.
+typedef void (*uCOMMS_GROUP_HANDLER)(void *user, size_t stream, const uint8_t *payload, size_t len);
+
+typedef struct {
+    size_t    count;         /// ? Streams.
+    size_t    cap;           /// ? Frame buffer per stream, payloads can be up to 2 bytes shorter.
+    uint8_t   crc_mode;      /// ? uCOMMS_CRC_MODE of every stream.
+    uint8_t  *flags;         /// ? COMMUNICATION_FLAGS, like uCOMMS_CONTEXT::comms_flags.
+    uint8_t  *len_shift;
+    uint8_t  *crc_got;
+    uint16_t *cmd_len;
+    uint16_t *cur_len;
+    uint32_t *crc;
+    uint32_t *trailer;       /// ? CRC trailer as received, little endian.
+    uint32_t *frames;        /// ? Frames handed out per stream.
+    uint32_t *dropped;       /// ? Frames thrown away per stream, like dropped_frames.
+    uint8_t  *slab;          /// ? Stream s parses into slab + s * cap.
+} uCOMMS_PARSER_GROUP;
+
+#define uCOMMS_GROUP_ALIGN 64
+#define group_round(n) (((n) + uCOMMS_GROUP_ALIGN - 1) & ~(size_t)(uCOMMS_GROUP_ALIGN - 1))
+
+// Returns the memory ucomms_group_init() needs for count streams of cap bytes.
+size_t ucomms_group_mem_size(size_t count, size_t cap) {
+    return 3 * group_round(count) + 2 * group_round(count * 2) + 4 * group_round(count * 4) + group_round(count * cap);
+}
+
+// Carves mem (ucomms_group_mem_size() bytes, 64 byte aligned) into the arrays
+// and slab of count streams, all hunting for a START_BYTE.
+void ucomms_group_init(uCOMMS_PARSER_GROUP *g, void *mem, size_t count, size_t cap, uint8_t crc_mode) {
+    CHECK_PTR(g);
+    CHECK_PTR(mem);
+    CHECK((((uintptr_t)mem & (uCOMMS_GROUP_ALIGN - 1)) == 0), "ucomms_group_init() mem must be 64 byte aligned");
+    CHECK((cap >= 2 && cap <= uCOMMS_MAX_BUFFER_SIZE), "ucomms_group_init() size");
+    memset(mem, 0, ucomms_group_mem_size(count, cap));
+
+    uint8_t *p = mem;
+    g->count     = count;
+    g->cap       = cap;
+    g->crc_mode  = crc_mode;
+    g->flags     = p;                      p += group_round(count);
+    g->len_shift = p;                      p += group_round(count);
+    g->crc_got   = p;                      p += group_round(count);
+    g->cmd_len   = (uint16_t *)(void *)p;  p += group_round(count * 2);
+    g->cur_len   = (uint16_t *)(void *)p;  p += group_round(count * 2);
+    g->crc       = (uint32_t *)(void *)p;  p += group_round(count * 4);
+    g->trailer   = (uint32_t *)(void *)p;  p += group_round(count * 4);
+    g->frames    = (uint32_t *)(void *)p;  p += group_round(count * 4);
+    g->dropped   = (uint32_t *)(void *)p;  p += group_round(count * 4);
+    g->slab      = p;
+}
+
+// Runs one stream over its chunk. Returns the number of frames.
+/// ? The stream's state is copied into a context for the whole chunk and
+/// ? written back once, the bytes go through parse_run() and parse_byte()
+/// ? like in parse_buf().
+size_t group_stream(uCOMMS_PARSER_GROUP *g, size_t s, const uint8_t *data, size_t len, uCOMMS_GROUP_HANDLER handler, void *user) {
+    uCOMMS_CONTEXT ctx = {
+        .comms_flags  = g->flags[s],
+        .cmd_len      = g->cmd_len[s],
+        .curr_cmd_len = g->cur_len[s],
+        .crc_mode     = g->crc_mode,
+        .crc_got      = g->crc_got[s],
+        .crc          = g->crc[s],
+        .len_shift    = g->len_shift[s],
+        .ext_cap      = (uint16_t)g->cap,
+        .ext_buf      = (char *)g->slab + s * g->cap,
+    };
+    for (int k = 0; k < 4; k++) ctx.crc_buf[k] = (uint8_t)(g->trailer[s] >> (8 * k));
+    size_t frames = 0;
+
+    size_t i = 0;
+    while (i < len) {
+        i += parse_run(&ctx, data + i, len - i);
+        if (i == len) break;
+        /// ? Opening a frame between frames is all parse_byte() would do, minus
+        /// ? clearing comms_buf, which the group never uses.
+        if (data[i] == START_BYTE && !frame_open(&ctx)) {
+            ctx.comms_flags  = 1 << START_BYTE_FLAG;
+            ctx.cmd_len      = 0;
+            ctx.curr_cmd_len = 0;
+            ctx.crc_got      = 0;
+            ctx.len_shift    = 0;
+            i++;
+            continue;
+        }
+        if (parse_byte(&ctx, (char)data[i++]) != PARSE_FRAME) continue;
+        frames++;
+        handler(user, s, (const uint8_t *)ctx.ext_buf, ctx.curr_cmd_len);
+    }
+
+    g->flags[s]     = ctx.comms_flags;
+    g->len_shift[s] = ctx.len_shift;
+    g->crc_got[s]   = ctx.crc_got;
+    g->cmd_len[s]   = ctx.cmd_len;
+    g->cur_len[s]   = ctx.curr_cmd_len;
+    g->crc[s]       = ctx.crc;
+    g->trailer[s]   = (uint32_t)ctx.crc_buf[0]       | (uint32_t)ctx.crc_buf[1] << 8 |
+                      (uint32_t)ctx.crc_buf[2] << 16 | (uint32_t)ctx.crc_buf[3] << 24;
+    g->frames[s]   += (uint32_t)frames;
+    g->dropped[s]  += ctx.dropped_frames;
+    return frames;
+}
+
+// Runs every stream over its new chunk in turn, data[s] and len[s] for
+// stream s (len 0 to skip it). handler gets every completed frame.
+// Returns the number of frames.
+size_t ucomms_group_parse(uCOMMS_PARSER_GROUP *g, const uint8_t *const *data, const size_t *len, uCOMMS_GROUP_HANDLER handler, void *user) {
+    CHECK_PTR(g);
+    CHECK_PTR(data);
+    CHECK_PTR(len);
+    CHECK_PTR(handler);
+    size_t frames = 0;
+    for (size_t s = 0; s < g->count; s++) {
+        if (len[s]) frames += group_stream(g, s, data[s], len[s], handler, user);
+    }
+    return frames;
+}
+
+// Drops whatever stream s was parsing, counters are kept.
+void ucomms_group_reset(uCOMMS_PARSER_GROUP *g, size_t s) {
+    CHECK_PTR(g);
+    CHECK((s < g->count), "ucomms_group_reset() stream");
+    g->flags[s]     = 0;
+    g->len_shift[s] = 0;
+    g->crc_got[s]   = 0;
+    g->cmd_len[s]   = 0;
+    g->cur_len[s]   = 0;
+}
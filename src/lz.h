@@ -0,0 +1,169 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "checks.h"
+#include "dispatch.h"    /// uCOMMS_VIEW
+
+/// * Per frame payload compression.
+/// * A port that agrees to it puts one flags byte in front of every payload:
+/// *
+/// *     {START_BYTE, MSG_LEN, PACK_FLAGS, BODY, STOP_BYTE}
+/// *
+/// * With uCOMMS_PACK_LZ clear BODY is the payload as is, with it set BODY is
+/// * {ORIG_LEN (varint), TOKENS}. ucomms_pack() only sets it when it actually
+/// * saves bytes, so the worst case cost is the flags byte.
+/// * TOKENS is byte aligned LZSS with a small window, in the spirit of
+/// * heatshrink: a control byte says, LSB first, whether each of the next 8
+/// * items is a literal byte or a 2 byte match {offset - 1 : 10, length - 3 : 6}
+/// * copied from up to uCOMMS_LZ_WINDOW bytes back. Every frame stands alone,
+/// * a lost frame never breaks the next one.
+/// * No malloc anywhere, the compressor needs a 2^uCOMMS_LZ_HASH_BITS entry
+/// * table on the stack, the decompressor nothing but its output buffer.
+
+#define uCOMMS_PACK_LZ        0x01     /// ? BODY is compressed.
+#define uCOMMS_PACK_RESERVED  0xFE     /// ? Must be 0, so new flags are refused by old peers.
+
+#define uCOMMS_LZ_WINDOW      1024
+#define uCOMMS_LZ_MIN_MATCH   3
+#define uCOMMS_LZ_MAX_MATCH   (uCOMMS_LZ_MIN_MATCH + 63)
+#ifndef uCOMMS_LZ_HASH_BITS
+#define uCOMMS_LZ_HASH_BITS   10       /// ? 2 KiB of stack, 8 suits a small target.
+#endif
+#define uCOMMS_LZ_NONE        0xFFFF   /// ? Empty hash slot.
+
+// Hashes the 3 bytes a match has to start with.
+uint32_t lz_hash(const uint8_t *p) {
+    uint32_t v = (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16;
+    return (v * 2654435761u) >> (32 - uCOMMS_LZ_HASH_BITS);
+}
+
+// Compresses in into out as {ORIG_LEN, TOKENS}.
+// Returns the size, or 0 as soon as it would not be smaller than cap.
+size_t lz_compress(const uint8_t *in, size_t len, uint8_t *out, size_t cap) {
+    uint16_t head[1u << uCOMMS_LZ_HASH_BITS];
+    memset(head, 0xFF, sizeof(head));
+    if (len > UINT16_MAX - 1) return 0;
+
+    size_t o = 0;
+    for (size_t v = len; ; v >>= 7) {
+        if (o >= cap) return 0;
+        out[o++] = (uint8_t)(v >= 0x80 ? (v | 0x80) : v);
+        if (v < 0x80) break;
+    }
+
+    size_t ctrl = 0;
+    unsigned bit = 8;
+    size_t i = 0;
+    while (i < len) {
+        if (bit == 8) {
+            if (o >= cap) return 0;
+            ctrl = o;
+            out[o++] = 0;
+            bit = 0;
+        }
+
+        size_t best = 0, cand = uCOMMS_LZ_NONE;
+        if (i + uCOMMS_LZ_MIN_MATCH <= len) {
+            uint32_t h = lz_hash(in + i);
+            cand = head[h];
+            head[h] = (uint16_t)i;
+            if (cand != uCOMMS_LZ_NONE && i - cand <= uCOMMS_LZ_WINDOW) {
+                size_t max = len - i < uCOMMS_LZ_MAX_MATCH ? len - i : uCOMMS_LZ_MAX_MATCH;
+                while (best < max && in[cand + best] == in[i + best]) best++;
+            }
+        }
+
+        if (best >= uCOMMS_LZ_MIN_MATCH) {
+            if (o + 2 > cap) return 0;
+            size_t off = i - cand - 1;
+            out[o++] = (uint8_t)off;
+            out[o++] = (uint8_t)((off >> 8) << 6 | (best - uCOMMS_LZ_MIN_MATCH));
+            out[ctrl] |= (uint8_t)(1u << bit);
+            /// ? Index the positions inside the match too, it is cheap and finds more.
+            for (size_t k = i + 1; k < i + best && k + uCOMMS_LZ_MIN_MATCH <= len; k++) head[lz_hash(in + k)] = (uint16_t)k;
+            i += best;
+        } else {
+            if (o >= cap) return 0;
+            out[o++] = in[i++];
+        }
+        bit++;
+    }
+    return o < cap ? o : 0;
+}
+
+// Expands {ORIG_LEN, TOKENS} into out.
+// Returns the size, or -1 if the input is malformed or does not fit cap.
+long lz_decompress(const uint8_t *in, size_t len, uint8_t *out, size_t cap) {
+    size_t i = 0, orig = 0;
+    for (unsigned shift = 0; ; shift += 7) {
+        if (i >= len || shift > 14) return -1;
+        orig |= (size_t)(in[i] & 0x7F) << shift;
+        if (!(in[i++] & 0x80)) break;
+    }
+    if (orig > cap) return -1;
+
+    size_t o = 0;
+    uint8_t ctrl = 0;
+    unsigned bit = 8;
+    while (o < orig) {
+        if (bit == 8) {
+            if (i >= len) return -1;
+            ctrl = in[i++];
+            bit = 0;
+        }
+        if (ctrl & (1u << bit++)) {
+            if (i + 2 > len) return -1;
+            size_t off = ((size_t)(in[i + 1] >> 6) << 8 | in[i]) + 1;
+            size_t n   = (size_t)(in[i + 1] & 0x3F) + uCOMMS_LZ_MIN_MATCH;
+            i += 2;
+            if (off > o || n > orig - o) return -1;
+            /// ? Byte by byte, a match may overlap what it produces.
+            for (size_t k = 0; k < n; k++, o++) out[o] = out[o - off];
+        } else {
+            if (i >= len) return -1;
+            out[o++] = in[i++];
+        }
+    }
+    return i == len ? (long)o : -1;
+}
+
+// Builds the payload for a compressing port: flags byte then the body,
+// compressed only if that saves something. out needs room for len + 1 bytes.
+// Returns the size, or 0 if out is too small.
+size_t ucomms_pack(const void *payload, size_t len, uint8_t *out, size_t cap) {
+    CHECK_PTR(out);
+    if (len) CHECK_PTR(payload);
+    if (cap < len + 1) return 0;
+
+    size_t n = len > uCOMMS_LZ_MIN_MATCH ? lz_compress(payload, len, out + 1, len) : 0;
+    if (n) {
+        out[0] = uCOMMS_PACK_LZ;
+        return n + 1;
+    }
+    out[0] = 0;
+    if (len) memcpy(out + 1, payload, len);
+    return len + 1;
+}
+
+// Opens a payload received on a compressing port. An uncompressed body is
+// returned as a view into the frame, a compressed one is expanded into out.
+// Returns 0, or -1 if the payload is malformed or does not fit out.
+int ucomms_unpack(const uint8_t *payload, size_t len, uint8_t *out, size_t cap, uCOMMS_VIEW *view) {
+    CHECK_PTR(view);
+    if (len == 0) return -1;
+    CHECK_PTR(payload);
+    if (payload[0] & uCOMMS_PACK_RESERVED) return -1;
+
+    if (!(payload[0] & uCOMMS_PACK_LZ)) {
+        *view = (uCOMMS_VIEW){(const char *)payload + 1, len - 1};
+        return 0;
+    }
+    CHECK_PTR(out);
+    long n = lz_decompress(payload + 1, len - 1, out, cap);
+    if (n < 0) return -1;
+    *view = (uCOMMS_VIEW){(const char *)out, (size_t)n};
+    return 0;
+}
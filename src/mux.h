@@ -0,0 +1,382 @@
+#pragma once
+
+#include <errno.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/ioctl.h>   /// TIOCOUTQ
+#include <sys/uio.h>
+
+#include "checks.h"
+#include "ucoms.h"
+#include "frame.h"
+#include "tx.h"
+#include "txq.h"
+#include "capture.h"
+
+/// * Logical channels on one port.
+/// * Messages are queued per channel and cut into fragments of at most mtu
+/// * bytes, every fragment is one frame whose first payload byte is the
+/// * channel header:
+/// *
+/// *     {START_BYTE, MSG_LEN, CHAN_HDR, FRAGMENT, STOP_BYTE}
+/// *     CHAN_HDR = channel (bits 0-5) | uCOMMS_MUX_MORE (bit 7) while more follow
+/// *
+/// * The scheduler picks the next fragment: lower priority numbers always go
+/// * first, channels sharing a priority take turns by deficit round robin,
+/// * each one sending up to its quantum of bytes per round. A control message
+/// * therefore waits for at most one fragment already on the wire, plus what
+/// * the tty still holds; ucomms_mux_pump() keeps that below max_outq bytes.
+/// * The pump never blocks: it stops at max_outq or when the port is full, and
+/// * what the port did not take goes out first next time. While
+/// * ucomms_mux_busy() wait for POLLOUT and pump again.
+/// * On an engine port the fragments go through the port's transmit queue
+/// * (ucomms_mux_queue()), so the fd has one writer and no frame can land in
+/// * the middle of another. ucomms_port_writable() with ucomms_mux_on_writable()
+/// * then pumps whenever the port has room.
+/// * Received fragments are put back together in the channel's own buffer.
+
+#ifndef uCOMMS_MUX_CHANNELS
+#define uCOMMS_MUX_CHANNELS   8        /// ? Channels per port, at most 64.
+#endif
+#ifndef uCOMMS_MUX_TXBUF
+#define uCOMMS_MUX_TXBUF      4096     /// ? Queued bytes per channel, a power of 2.
+#endif
+#ifndef uCOMMS_MUX_RXBUF
+#define uCOMMS_MUX_RXBUF      4096     /// ? Largest message a channel receives.
+#endif
+#define uCOMMS_MUX_QUEUE      16       /// ? Queued messages per channel, a power of 2.
+#define uCOMMS_MUX_MTU_MAX    1024     /// ? Largest fragment.
+#define uCOMMS_MUX_MORE       0x80
+#define uCOMMS_MUX_CHAN_MASK  0x3F
+
+_Static_assert(uCOMMS_MUX_CHANNELS <= uCOMMS_MUX_CHAN_MASK + 1, "channel id must fit CHAN_HDR");
+_Static_assert((uCOMMS_MUX_TXBUF & (uCOMMS_MUX_TXBUF - 1)) == 0, "uCOMMS_MUX_TXBUF must be a power of 2");
+
+typedef void (*uCOMMS_MUX_HANDLER)(void *user, uint8_t chan, const uint8_t *msg, size_t len);
+
+typedef struct {
+    uint8_t  priority;       /// ? 0 goes first.
+    uint16_t quantum;        /// ? Bytes per round robin turn, at least one fragment is sent anyway.
+    int32_t  deficit;
+    /// ? Transmit side, a byte ring and the lengths of the messages in it.
+    uint32_t tx_head, tx_tail;            /// ? Free running, masked on use.
+    uint32_t msg_len[uCOMMS_MUX_QUEUE];
+    uint8_t  msg_head, msg_tail;
+    uint32_t msg_sent;                    /// ? Bytes of the head message already sent.
+    uint8_t  tx[uCOMMS_MUX_TXBUF];
+    /// ? Receive side.
+    uCOMMS_MUX_HANDLER on_msg;
+    void    *user;
+    uint32_t rx_len;
+    uint8_t  rx_discard;     /// ? Rest of an oversized message is skipped.
+    uint8_t  rx[uCOMMS_MUX_RXBUF];
+    /// ? Counters.
+    uint32_t tx_msgs, tx_frames, rx_msgs, rx_overflows;
+} uCOMMS_MUX_CHANNEL;
+
+typedef struct {
+    int      fd;
+    uint8_t  crc_mode;       /// ? uCOMMS_CRC_MODE of the port.
+    uint16_t mtu;            /// ? Fragment size, the peer's frame buffer minus 3.
+    size_t   max_outq;       /// ? Bytes allowed to sit in the tty before pump() stops.
+    uint8_t  rr;             /// ? Round robin cursor.
+    uint32_t unknown_chans;  /// ? Frames for a channel we do not have.
+    uCOMMS_TXQ *txq;         /// ? Queue fragments go through, see ucomms_mux_queue().
+    uCOMMS_CAPTURE *capture; /// ? Raw TX log, see ucomms_mux_capture().
+    uint8_t  capture_stream;
+    size_t   out_off;        /// ? Encoded fragments the port has not taken yet
+    size_t   out_len;        /// ? are out[out_off] to out[out_len].
+    uint8_t  out[uCOMMS_ENCODED_MAX(1 + uCOMMS_MUX_MTU_MAX) + 16];
+    uCOMMS_MUX_CHANNEL chans[uCOMMS_MUX_CHANNELS];
+} uCOMMS_MUX;
+
+// Sets up a mux on a port, every channel at priority 0 with one fragment of
+// quantum. The default mtu fits a peer with the embedded 64 byte buffer.
+void ucomms_mux_init(uCOMMS_MUX *mux, int fd) {
+    CHECK_PTR(mux);
+    memset(mux, 0, sizeof(*mux));
+    mux->fd       = fd;
+    mux->mtu      = uCOMMS_MAX_PAYLOAD - 1;
+    mux->max_outq = 256;
+    for (size_t c = 0; c < uCOMMS_MUX_CHANNELS; c++) mux->chans[c].quantum = mux->mtu;
+}
+
+// Sets a channel's scheduling class and receive handler (NULL drops messages).
+void ucomms_mux_channel(uCOMMS_MUX *mux, uint8_t chan, uint8_t priority, uint16_t quantum,
+                        uCOMMS_MUX_HANDLER on_msg, void *user) {
+    CHECK_PTR(mux);
+    CHECK((chan < uCOMMS_MUX_CHANNELS), "ucomms_mux_channel() channel");
+    CHECK((quantum > 0), "ucomms_mux_channel() quantum");
+    uCOMMS_MUX_CHANNEL *ch = &mux->chans[chan];
+    ch->priority = priority;
+    ch->quantum  = quantum;
+    ch->on_msg   = on_msg;
+    ch->user     = user;
+}
+
+// Logs every fragment the mux sends as TX records of one stream of cap, like
+// ucomms_port_capture(). NULL stops. Not used with ucomms_mux_queue(), the
+// queue logs what it sends.
+void ucomms_mux_capture(uCOMMS_MUX *mux, uCOMMS_CAPTURE *cap, uint8_t stream) {
+    CHECK_PTR(mux);
+    mux->capture        = cap;
+    mux->capture_stream = stream;
+}
+
+// Sends fragments through a transmit queue, an engine port's port->txq,
+// instead of writing fd. The queue then does all the writing, stats and
+// capture. NULL goes back to writing fd.
+void ucomms_mux_queue(uCOMMS_MUX *mux, uCOMMS_TXQ *q) {
+    CHECK_PTR(mux);
+    CHECK((!mux->out_len), "ucomms_mux_queue() with fragments half written");
+    mux->txq = q;
+}
+
+// Returns 1 if the channel has something to send.
+int mux_backlogged(const uCOMMS_MUX_CHANNEL *ch) {
+    return ch->msg_head != ch->msg_tail;
+}
+
+// Queues a message on a channel, the data is copied.
+// Returns 0, or -1 with errno set: EAGAIN when the channel queue is full,
+// EMSGSIZE when the message can never fit it.
+int ucomms_mux_send(uCOMMS_MUX *mux, uint8_t chan, const void *msg, size_t len) {
+    CHECK_PTR(mux);
+    CHECK((chan < uCOMMS_MUX_CHANNELS), "ucomms_mux_send() channel");
+    if (len) CHECK_PTR(msg);
+    uCOMMS_MUX_CHANNEL *ch = &mux->chans[chan];
+
+    if (len > uCOMMS_MUX_TXBUF) {
+        errno = EMSGSIZE;
+        return -1;
+    }
+    if ((uint8_t)(ch->msg_tail - ch->msg_head) == uCOMMS_MUX_QUEUE || uCOMMS_MUX_TXBUF - (ch->tx_tail - ch->tx_head) < len) {
+        errno = EAGAIN;
+        return -1;
+    }
+
+    /// ? Copy in at most two pieces around the end of the ring.
+    uint32_t at    = ch->tx_tail & (uCOMMS_MUX_TXBUF - 1);
+    size_t   first = len < uCOMMS_MUX_TXBUF - at ? len : uCOMMS_MUX_TXBUF - at;
+    memcpy(ch->tx + at, msg, first);
+    memcpy(ch->tx, (const uint8_t *)msg + first, len - first);
+    ch->tx_tail += (uint32_t)len;
+    ch->msg_len[ch->msg_tail++ % uCOMMS_MUX_QUEUE] = (uint32_t)len;
+    ch->tx_msgs++;
+    return 0;
+}
+
+// Returns the size of the channel's next fragment.
+size_t mux_next_fragment(const uCOMMS_MUX *mux, const uCOMMS_MUX_CHANNEL *ch) {
+    size_t left = ch->msg_len[ch->msg_head % uCOMMS_MUX_QUEUE] - ch->msg_sent;
+    return left < mux->mtu ? left : mux->mtu;
+}
+
+// Picks the channel the next fragment comes from, or -1 when all are idle.
+int mux_pick(uCOMMS_MUX *mux) {
+    int top = -1;
+    for (size_t c = 0; c < uCOMMS_MUX_CHANNELS; c++) {
+        const uCOMMS_MUX_CHANNEL *ch = &mux->chans[c];
+        if (mux_backlogged(ch) && (top < 0 || ch->priority < top)) top = ch->priority;
+    }
+    if (top < 0) return -1;
+
+    /// ? Deficit round robin over the backlogged channels of the top priority.
+    /// ? The cursor stays on a channel while its deficit lasts, every visit
+    /// ? that cannot afford a fragment tops it up, so this always ends.
+    for (;;) {
+        uCOMMS_MUX_CHANNEL *ch = &mux->chans[mux->rr];
+        if (mux_backlogged(ch) && ch->priority == top) {
+            int32_t need = (int32_t)mux_next_fragment(mux, ch);
+            if (ch->deficit >= need) {
+                ch->deficit -= need;
+                return mux->rr;
+            }
+            ch->deficit += ch->quantum;
+        }
+        mux->rr = (uint8_t)((mux->rr + 1) % uCOMMS_MUX_CHANNELS);
+    }
+}
+
+// Copies the next fragment of a channel, header first, into frag without
+// taking it off the queue. Returns the payload size.
+size_t mux_fragment(const uCOMMS_MUX *mux, uint8_t chan, uint8_t *frag) {
+    const uCOMMS_MUX_CHANNEL *ch = &mux->chans[chan];
+    size_t   n    = mux_next_fragment(mux, ch);
+    uint32_t len  = ch->msg_len[ch->msg_head % uCOMMS_MUX_QUEUE];
+    int      more = ch->msg_sent + n < len;
+
+    frag[0] = (uint8_t)(chan | (more ? uCOMMS_MUX_MORE : 0));
+    for (size_t i = 0; i < n; i++) frag[1 + i] = ch->tx[(ch->tx_head + i) & (uCOMMS_MUX_TXBUF - 1)];
+    return 1 + n;
+}
+
+// Takes the fragment mux_fragment() copied off its channel.
+void mux_consume(uCOMMS_MUX *mux, uint8_t chan) {
+    uCOMMS_MUX_CHANNEL *ch = &mux->chans[chan];
+    size_t   n    = mux_next_fragment(mux, ch);
+    uint32_t len  = ch->msg_len[ch->msg_head % uCOMMS_MUX_QUEUE];
+    int      more = ch->msg_sent + n < len;
+
+    ch->tx_head  += (uint32_t)n;
+    ch->msg_sent += (uint32_t)n;
+    ch->tx_frames++;
+    if (!more) {
+        ch->msg_head++;
+        ch->msg_sent = 0;
+        if (!mux_backlogged(ch)) ch->deficit = 0;   /// ? Idle channels do not bank credit.
+    }
+}
+
+// Encodes the next fragment of a channel into out, returns the frame size or
+// 0 if out is too small (the fragment stays queued).
+size_t mux_encode_fragment(uCOMMS_MUX *mux, uint8_t chan, uint8_t *out, size_t cap) {
+    uint8_t frag[1 + uCOMMS_MUX_MTU_MAX];
+    size_t  size = encode_frame_crc(mux->crc_mode, frag, mux_fragment(mux, chan, frag), out, cap);
+    if (size) mux_consume(mux, chan);
+    return size;
+}
+
+// Returns the bytes still queued in the tty, 0 for fds that cannot tell.
+size_t mux_outq(int fd) {
+    int queued = 0;
+    if (ioctl(fd, TIOCOUTQ, &queued) != 0 || queued < 0) return 0;
+    return (size_t)queued;
+}
+
+// Returns 1 while the mux has something to send: bytes the port has not
+// taken yet or fragments queued on a channel.
+int ucomms_mux_busy(const uCOMMS_MUX *mux) {
+    CHECK_PTR(mux);
+    if (mux->out_len) return 1;
+    for (size_t c = 0; c < uCOMMS_MUX_CHANNELS; c++) {
+        if (mux_backlogged(&mux->chans[c])) return 1;
+    }
+    return 0;
+}
+
+// Logs the fragments encoded into out since it was last empty.
+void mux_capture(uCOMMS_MUX *mux) {
+    if (mux->capture && mux->out_len) ucomms_capture_append(mux->capture, mux->capture_stream, uCOMMS_CAPTURE_TX, mux->out, mux->out_len);
+}
+
+// Writes what the port takes of out without blocking, the rest stays.
+// Returns 0, or -1 with errno set.
+int mux_write(uCOMMS_MUX *mux) {
+    if (!mux->out_len) return 0;
+    struct iovec iov = {mux->out + mux->out_off, mux->out_len - mux->out_off}, *v = &iov;
+    int cnt = 1;
+    ssize_t n = writev_some(mux->fd, &v, &cnt);
+    if (n < 0) return -1;
+    mux->out_off += (size_t)n;
+    if (mux->out_off == mux->out_len) mux->out_off = mux->out_len = 0;
+    return 0;
+}
+
+// ucomms_mux_pump() through mux->txq: fragments are queued while the tty and
+// the queue hold less than max_outq bytes, then flushed together.
+int mux_pump_queue(uCOMMS_MUX *mux, int max_frames) {
+    uCOMMS_TXQ *q = mux->txq;
+    size_t queued = mux_outq(q->fd) + ucomms_txq_pending(q) + (q->used - q->out);
+    int    sent   = 0;
+    while (sent < max_frames && queued < mux->max_outq) {
+        int chan = mux_pick(mux);
+        if (chan < 0) break;
+        uint8_t frag[1 + uCOMMS_MUX_MTU_MAX];
+        size_t  n = mux_fragment(mux, (uint8_t)chan, frag);
+        if (ucomms_txq_send(q, frag, n, 0) < 0) {
+            /// ? EAGAIN: the queue is backed up, its EPOLLOUT brings us back.
+            mux->chans[chan].deficit += (int32_t)(n - 1);
+            if (errno == EAGAIN) break;
+            return -1;
+        }
+        mux_consume(mux, (uint8_t)chan);
+        queued += n;
+        sent++;
+    }
+    /// ? Fragments go out now, not after the queue's delay.
+    if (sent && ucomms_txq_flush(q) < 0) return -1;
+    return sent;
+}
+
+// Sends up to max_frames fragments in scheduler order, fewer once the tty
+// holds max_outq bytes or the port is full. Call it again when the port is
+// writable, see ucomms_mux_busy().
+// Returns the number of fragments handed to the port, or -1 with errno set.
+int ucomms_mux_pump(uCOMMS_MUX *mux, int max_frames) {
+    CHECK_PTR(mux);
+    CHECK((mux->mtu >= 1 && mux->mtu <= uCOMMS_MUX_MTU_MAX), "ucomms_mux_pump() mtu");
+    if (mux->txq) return mux_pump_queue(mux, max_frames);
+
+    /// ? What the port did not take last time goes first, nothing overtakes it.
+    if (mux_write(mux) < 0) return -1;
+    if (mux->out_len || !ucomms_mux_busy(mux)) return 0;
+
+    size_t queued = mux_outq(mux->fd);
+    int    sent   = 0;
+    while (sent < max_frames && queued + mux->out_len < mux->max_outq) {
+        int chan = mux_pick(mux);
+        if (chan < 0) break;
+        size_t n = mux_encode_fragment(mux, (uint8_t)chan, mux->out + mux->out_len, sizeof(mux->out) - mux->out_len);
+        if (!n) {
+            /// ? Buffer full, give the deficit back and write what we have.
+            mux->chans[chan].deficit += (int32_t)mux_next_fragment(mux, &mux->chans[chan]);
+            size_t len = mux->out_len;
+            mux_capture(mux);
+            if (mux_write(mux) < 0) return -1;
+            if (mux->out_len) return sent;
+            queued += len;
+            continue;
+        }
+        mux->out_len += n;
+        sent++;
+    }
+    mux_capture(mux);
+    return mux_write(mux) < 0 ? -1 : sent;
+}
+
+// Engine hook, see ucomms_port_writable(): pumps the mux given as user, which
+// has to send through the port's queue (ucomms_mux_queue()).
+// Returns 1 while there is more to send.
+int ucomms_mux_on_writable(void *user) {
+    uCOMMS_MUX *mux = user;
+    CHECK((mux->txq != NULL), "ucomms_mux_on_writable() mux does not send through the port's txq");
+    if (ucomms_mux_pump(mux, uCOMMS_MUX_CHANNELS * uCOMMS_MUX_QUEUE) < 0) return 0;
+    return ucomms_mux_busy(mux);
+}
+
+// Feeds one received frame to its channel, a complete message goes to the
+// channel's handler. Returns 1 if the frame belonged to a channel, 0 if not.
+int ucomms_mux_on_frame(uCOMMS_MUX *mux, const uint8_t *payload, size_t len) {
+    CHECK_PTR(mux);
+    if (len == 0) return 0;
+    CHECK_PTR(payload);
+
+    uint8_t chan = payload[0] & uCOMMS_MUX_CHAN_MASK;
+    if (chan >= uCOMMS_MUX_CHANNELS) {
+        mux->unknown_chans++;
+        return 0;
+    }
+    uCOMMS_MUX_CHANNEL *ch = &mux->chans[chan];
+    int more = (payload[0] & uCOMMS_MUX_MORE) != 0;
+    len--;
+
+    if (!ch->rx_discard && ch->rx_len + len > uCOMMS_MUX_RXBUF) {
+        ch->rx_overflows++;
+        ch->rx_discard = 1;
+    }
+    if (!ch->rx_discard) {
+        memcpy(ch->rx + ch->rx_len, payload + 1, len);
+        ch->rx_len += (uint32_t)len;
+    }
+    if (more) return 1;
+
+    if (!ch->rx_discard) {
+        ch->rx_msgs++;
+        if (ch->on_msg) ch->on_msg(ch->user, chan, ch->rx, ch->rx_len);
+    }
+    ch->rx_len     = 0;
+    ch->rx_discard = 0;
+    return 1;
+}
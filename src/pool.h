@@ -0,0 +1,81 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "checks.h"
+#include "ucoms.h"
+
+/// * Fixed size slab pool for frame buffers.
+/// * Carves caller provided memory into equal slabs kept on a free list, so a
+/// * gateway can give every port a large frame buffer without malloc() on the
+/// * receive path. Not thread safe, one pool per thread.
+
+typedef struct {
+    uint8_t *base;
+    size_t   slab_size;    /// ? Bytes per slab, at least sizeof(void *).
+    size_t   slabs;
+    size_t   in_use;
+    void    *free_list;    /// ? First free slab, each free slab starts with the next pointer.
+} uCOMMS_POOL;
+
+// Splits mem (pointer aligned) into as many slab_size slabs as fit.
+// Returns the number of slabs.
+size_t pool_init(uCOMMS_POOL *pool, void *mem, size_t mem_size, size_t slab_size) {
+    CHECK_PTR(pool);
+    CHECK_PTR(mem);
+    CHECK((slab_size >= sizeof(void *)), "pool_init() slab too small");
+    CHECK((((uintptr_t)mem & (_Alignof(void *) - 1)) == 0), "pool_init() mem must be pointer aligned");
+
+    /// ? Keep slabs pointer aligned so the free list links can live in them.
+    slab_size = (slab_size + sizeof(void *) - 1) & ~(sizeof(void *) - 1);
+    pool->base      = mem;
+    pool->slab_size = slab_size;
+    pool->slabs     = mem_size / slab_size;
+    pool->in_use    = 0;
+    pool->free_list = NULL;
+    for (size_t i = pool->slabs; i-- > 0;) {
+        void *slab = pool->base + i * slab_size;
+        *(void **)slab = pool->free_list;
+        pool->free_list = slab;
+    }
+    return pool->slabs;
+}
+
+// Takes one slab, NULL when the pool is empty.
+void *pool_alloc(uCOMMS_POOL *pool) {
+    CHECK_PTR(pool);
+    void *slab = pool->free_list;
+    if (!slab) return NULL;
+    pool->free_list = *(void **)slab;
+    pool->in_use++;
+    return slab;
+}
+
+// Gives a slab back.
+void pool_free(uCOMMS_POOL *pool, void *slab) {
+    CHECK_PTR(pool);
+    if (!slab) return;
+    CHECK(((uint8_t *)slab >= pool->base && (uint8_t *)slab < pool->base + pool->slabs * pool->slab_size),
+          "pool_free() slab not from this pool");
+    *(void **)slab = pool->free_list;
+    pool->free_list = slab;
+    pool->in_use--;
+}
+
+// Gives a context a slab from the pool as its frame buffer.
+// Returns 0, or -1 if the pool is empty.
+int attach_pool_buffer(uCOMMS_CONTEXT *ctx, uCOMMS_POOL *pool) {
+    void *slab = pool_alloc(pool);
+    if (!slab) return -1;
+    size_t cap = pool->slab_size < uCOMMS_MAX_BUFFER_SIZE ? pool->slab_size : uCOMMS_MAX_BUFFER_SIZE;
+    attach_buffer(ctx, slab, cap);
+    return 0;
+}
+
+// Returns the context's slab to the pool, it goes back to comms_buf.
+void release_pool_buffer(uCOMMS_CONTEXT *ctx, uCOMMS_POOL *pool) {
+    CHECK_PTR(ctx);
+    pool_free(pool, ctx->ext_buf);
+    attach_buffer(ctx, NULL, 0);
+}
@@ -0,0 +1,171 @@
+#pragma once
+
+/// * Serial port setup.
+/// * A serial port is just a file under /dev/tty*, but before we can read and
+/// * write anything meaningful we need to set it up through a termios struct.
+/// * RESOURCES:
+/// * https://blog.mbedded.ninja/programming/operating-systems/linux/linux-serial-ports-using-c-cpp/
+
+#include <errno.h>
+#include <fcntl.h>       /// Contains file controls like O_RWDR
+#include <stdint.h>
+#include <termios.h>     /// contains POSIX terminal control definitions
+#include <unistd.h>      /// write(), read(), close()
+#include <sys/ioctl.h>   /// termios2 and serial_struct ioctls
+#include <linux/serial.h>    /// struct serial_struct, ASYNC_LOW_LATENCY
+
+#include "checks.h"
+
+/// * Port settings. Any baud rate goes: the standard ones through termios,
+/// * anything else through termios2 with BOTHER, which <termios.h> does not
+/// * expose, so the struct and ioctls are spelled out below.
+/// * VMIN batches reads: with VTIME 0 a read, and a poll()/epoll wakeup, waits
+/// * for VMIN bytes, trading latency for fewer syscalls. Settings a driver does
+/// * not have (ASYNC_LOW_LATENCY on a pty) are skipped rather than failing,
+/// * ucomms_port_get() tells what actually stuck.
+typedef struct {
+    uint32_t baud;           /// ? Bits per second, e.g. 9600 or 3000000.
+    uint8_t  vmin;           /// ? Bytes a read waits for, 0 to 255.
+    uint8_t  vtime;          /// ? Read timeout in 0.1 s once a byte came, 0 for none.
+    uint8_t  rtscts;         /// ? Hardware (RTS/CTS) flow control.
+    uint8_t  low_latency;    /// ? ASYNC_LOW_LATENCY, push received bytes up without delay.
+} uCOMMS_PORT_CONFIG;
+
+/// ? What the tool always used: 9600 8N1, one byte per read.
+#define uCOMMS_PORT_DEFAULTS ((uCOMMS_PORT_CONFIG){.baud = 9600, .vmin = 1, .vtime = 0})
+
+struct ucomms_termios2 {
+    tcflag_t c_iflag, c_oflag, c_cflag, c_lflag;
+    cc_t     c_line;
+    cc_t     c_cc[19];
+    speed_t  c_ispeed, c_ospeed;
+};
+#define uCOMMS_TCGETS2  _IOR('T', 0x2A, struct ucomms_termios2)
+#define uCOMMS_TCSETS2  _IOW('T', 0x2B, struct ucomms_termios2)
+#define uCOMMS_BOTHER   0010000
+#define uCOMMS_IBSHIFT  16       /// ? Input speed bits sit above the output ones.
+
+// Returns the Bxxx constant for a standard rate, or 0 for anything else.
+speed_t port_speed_constant(uint32_t baud) {
+    static const struct { uint32_t baud; speed_t speed; } rates[] = {
+        {1200, B1200}, {2400, B2400}, {4800, B4800}, {9600, B9600}, {19200, B19200},
+        {38400, B38400}, {57600, B57600}, {115200, B115200}, {230400, B230400},
+        {460800, B460800}, {500000, B500000}, {576000, B576000}, {921600, B921600},
+        {1000000, B1000000}, {1152000, B1152000}, {1500000, B1500000}, {2000000, B2000000},
+        {2500000, B2500000}, {3000000, B3000000}, {3500000, B3500000}, {4000000, B4000000},
+    };
+    for (size_t i = 0; i < sizeof(rates) / sizeof(rates[0]); i++) {
+        if (rates[i].baud == baud) return rates[i].speed;
+    }
+    return 0;
+}
+
+// Sets a rate no Bxxx constant covers. Returns 0, or -1 with errno set.
+int port_set_custom_baud(int fd, uint32_t baud) {
+    struct ucomms_termios2 tio;
+    if (ioctl(fd, uCOMMS_TCGETS2, &tio) != 0) return -1;
+    tio.c_cflag &= ~(tcflag_t)(CBAUD | (CBAUD << uCOMMS_IBSHIFT));
+    tio.c_cflag |= uCOMMS_BOTHER | (uCOMMS_BOTHER << uCOMMS_IBSHIFT);
+    tio.c_ispeed = baud;
+    tio.c_ospeed = baud;
+    return ioctl(fd, uCOMMS_TCSETS2, &tio);
+}
+
+// Turns ASYNC_LOW_LATENCY on or off, quietly skipped by drivers without it.
+// Returns 0, or -1 with errno set.
+int port_set_low_latency(int fd, int on) {
+    struct serial_struct ss;
+    if (ioctl(fd, TIOCGSERIAL, &ss) != 0) return (errno == ENOTTY || errno == EINVAL) ? 0 : -1;
+    ss.flags = on ? (ss.flags | ASYNC_LOW_LATENCY) : (ss.flags & ~ASYNC_LOW_LATENCY);
+    if (ioctl(fd, TIOCSSERIAL, &ss) != 0) return (errno == ENOTTY || errno == EINVAL) ? 0 : -1;
+    return 0;
+}
+
+// Puts an open tty into raw 8N1 mode with the given settings.
+// Returns 0, or -1 with errno set.
+int ucomms_port_apply(int fd, const uCOMMS_PORT_CONFIG *cfg) {
+    CHECK_PTR(cfg);
+    // / We need to create a new termios struct, and then write the existing
+    // / configuration of the serial port to it, before modifying these
+    // / parameters and then saving.
+    struct termios tty;
+    if (tcgetattr(fd, &tty) != 0) return -1;
+
+    // / Now we can modify tty's settings as needed
+    // / PARENB (Parity)
+    // / If this bit is set, generation and detection of the parity bit is enabled.
+    // / Most serial communications do not use a parity bit, s
+    tty.c_cflag &= ~PARENB;         // Clear parity bit.
+    tty.c_cflag &= ~CSTOPB;         // one stop bit.
+    tty.c_cflag &= ~CSIZE;          // clear all the size bits.
+    tty.c_cflag |=  CS8;            // 8 bits per byte.
+    tty.c_cflag |=  CREAD | CLOCAL; //Turn on read & ignore ctrl lines.
+    if (cfg->rtscts) tty.c_cflag |= CRTSCTS;   // RTS/CTS flow control.
+    else             tty.c_cflag &= ~CRTSCTS;
+    tty.c_lflag &= ~ICANON;         // disable canonical mode.
+    tty.c_lflag &= ~ECHO;           // disable echo.
+    tty.c_lflag &= ~ECHOE;          // disable erasure.
+    tty.c_lflag &= ~ECHONL;         // disable new-line echo.
+    tty.c_lflag &= ~ISIG;           // disable interpretation of INTR, QUIT and SUSP.
+    tty.c_iflag &= ~(IXON | IXOFF | IXANY); // No software flow control.
+    tty.c_iflag &= ~(IGNBRK | BRKINT | PARMRK | ISTRIP | INLCR | IGNCR | ICRNL); // Disable any special handling of received bytes
+    tty.c_oflag &= ~OPOST;           // Prevent special interpretation of output bytes.
+    tty.c_oflag &= ~ONLCR;           // Prevent conversion of newline to carriage return/line feed.
+    tty.c_cc[VMIN]  = cfg->vmin;     // Read at least vmin bytes
+    tty.c_cc[VTIME] = cfg->vtime;    // Timeout in deciseconds.
+
+    // / Standard rates go in the termios struct, anything else needs termios2.
+    speed_t speed = port_speed_constant(cfg->baud);
+    if (speed) {
+        cfsetispeed(&tty, speed);    // set in baud rate.
+        cfsetospeed(&tty, speed);    // set out baud rate.
+    }
+
+    // / We can now save our new serial port setting s and check for any errors:
+    if (tcsetattr(fd, TCSANOW, &tty) != 0) return -1;
+    if (!speed && port_set_custom_baud(fd, cfg->baud) != 0) return -1;
+    return port_set_low_latency(fd, cfg->low_latency);
+}
+
+// Reads back the settings a tty actually has. Returns 0, or -1 with errno set.
+int ucomms_port_get(int fd, uCOMMS_PORT_CONFIG *cfg) {
+    CHECK_PTR(cfg);
+    struct ucomms_termios2 tio;
+    if (ioctl(fd, uCOMMS_TCGETS2, &tio) != 0) return -1;
+    cfg->baud   = tio.c_ospeed;
+    cfg->vmin   = tio.c_cc[VMIN];
+    cfg->vtime  = tio.c_cc[VTIME];
+    cfg->rtscts = (tio.c_cflag & CRTSCTS) != 0;
+
+    struct serial_struct ss;
+    cfg->low_latency = ioctl(fd, TIOCGSERIAL, &ss) == 0 && (ss.flags & ASYNC_LOW_LATENCY);
+    return 0;
+}
+
+// Puts an open tty into raw 8N1 mode at 9600 baud.
+// Returns 0, or -1 with errno set.
+int ucomms_port_configure(int fd) {
+    return ucomms_port_apply(fd, &uCOMMS_PORT_DEFAULTS);
+}
+
+// Opens a serial port in non-blocking mode and applies cfg to it.
+// Returns the fd, or -1 with errno set.
+int ucomms_port_open_config(const char *path, const uCOMMS_PORT_CONFIG *cfg) {
+    CHECK_PTR(path);
+    int fd = open(path, O_RDWR | O_NOCTTY | O_NONBLOCK | O_CLOEXEC);
+    if (fd < 0) return -1;
+
+    if (ucomms_port_apply(fd, cfg) != 0) {
+        int err = errno;
+        close(fd);
+        errno = err;
+        return -1;
+    }
+    return fd;
+}
+
+// Opens and configures a serial port in non-blocking mode.
+// Returns the fd, or -1 with errno set.
+int ucomms_port_open(const char *path) {
+    return ucomms_port_open_config(path, &uCOMMS_PORT_DEFAULTS);
+}
@@ -0,0 +1,180 @@
+#pragma once
+
+#include <errno.h>
+#include <poll.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <threads.h>
+#include <unistd.h>
+
+#include "checks.h"
+#include "ucoms.h"
+
+/// * Threaded receive mode.
+/// * A reader thread drains the tty and runs the parser, completed frames are
+/// * published into a single-producer/single-consumer ring of preallocated
+/// * slots. The application thread pops them without locks or allocations, so
+/// * a slow handler never holds up the tty.
+
+#define uCOMMS_RING_SLOTS 256      /// ? Frames in flight, must be a power of two.
+#define uCOMMS_CACHE_LINE 64
+#define uCOMMS_RING_FULL_SPINS 10000   /// ? Yields on a full ring before a frame is dropped.
+
+/// ? Payload bytes per slot, raise it to carry large frames through the ring.
+#ifndef uCOMMS_RING_SLOT_SIZE
+#define uCOMMS_RING_SLOT_SIZE uCOMMS_CONTEXT_BUFFER_SIZE
+#endif
+
+_Static_assert((uCOMMS_RING_SLOTS & (uCOMMS_RING_SLOTS - 1)) == 0, "uCOMMS_RING_SLOTS must be a power of two");
+
+typedef struct {
+    uint16_t len;
+    uint8_t  payload[uCOMMS_RING_SLOT_SIZE];
+} uCOMMS_FRAME_SLOT;
+
+typedef struct {
+    /// ? Each index sits on its own cache line next to the other side's
+    /// ? cached copy, so the two threads only share a line when they have to.
+    _Alignas(uCOMMS_CACHE_LINE) _Atomic size_t head;   /// ? Next slot to fill, producer owned.
+    size_t                                     tail_cache;
+    _Alignas(uCOMMS_CACHE_LINE) _Atomic size_t tail;   /// ? Next slot to read, consumer owned.
+    size_t                                     head_cache;
+    _Alignas(uCOMMS_CACHE_LINE) _Atomic uint32_t overruns;   /// ? Frames dropped on a full ring.
+    _Alignas(uCOMMS_CACHE_LINE) uCOMMS_FRAME_SLOT slots[uCOMMS_RING_SLOTS];
+} uCOMMS_FRAME_RING;
+
+// Publishes one frame. Producer side only.
+// Returns 0, or -1 when the ring is full.
+int ring_push(uCOMMS_FRAME_RING *ring, const void *payload, size_t len) {
+    size_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    if (head - ring->tail_cache == uCOMMS_RING_SLOTS) {
+        ring->tail_cache = atomic_load_explicit(&ring->tail, memory_order_acquire);
+        if (head - ring->tail_cache == uCOMMS_RING_SLOTS) return -1;
+    }
+
+    uCOMMS_FRAME_SLOT *slot = &ring->slots[head & (uCOMMS_RING_SLOTS - 1)];
+    slot->len = (uint16_t)len;
+    memcpy(slot->payload, payload, len);
+    atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+    return 0;
+}
+
+// Returns the oldest frame, or NULL if there is none. Consumer side only.
+// The slot stays valid until ring_pop().
+const uCOMMS_FRAME_SLOT *ring_peek(uCOMMS_FRAME_RING *ring) {
+    size_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    if (tail == ring->head_cache) {
+        ring->head_cache = atomic_load_explicit(&ring->head, memory_order_acquire);
+        if (tail == ring->head_cache) return NULL;
+    }
+    return &ring->slots[tail & (uCOMMS_RING_SLOTS - 1)];
+}
+
+// Hands the slot returned by ring_peek() back to the producer.
+void ring_pop(uCOMMS_FRAME_RING *ring) {
+    size_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    atomic_store_explicit(&ring->tail, tail + 1, memory_order_release);
+}
+
+
+typedef struct {
+    int               fd;          /// ? Port being drained, see ucomms_port_open().
+    int               wake_fd;     /// ? eventfd used to stop the thread.
+    thrd_t            thread;
+    uCOMMS_CONTEXT    ctx;         /// ? Only touched by the reader thread.
+#if uCOMMS_RING_SLOT_SIZE > uCOMMS_CONTEXT_BUFFER_SIZE
+    char              frame[uCOMMS_RING_SLOT_SIZE];   /// ? Frame buffer attached to ctx.
+#endif
+    uCOMMS_FRAME_RING ring;
+} uCOMMS_READER;
+
+// Reader thread body: poll, read, parse, publish.
+int reader_main(void *arg) {
+    uCOMMS_READER *rd = arg;
+    uint8_t buf[4096];
+    struct pollfd pfd[2] = {
+        {.fd = rd->fd,      .events = POLLIN},
+        {.fd = rd->wake_fd, .events = POLLIN},
+    };
+
+    for (;;) {
+        if (poll(pfd, 2, -1) < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        if (pfd[1].revents) return 0;
+
+        ssize_t n = read(rd->fd, buf, sizeof(buf));
+        if (n < 0 && (errno == EAGAIN || errno == EINTR)) continue;
+        if (n <= 0) return -1;    /// ? Port hung up.
+
+        const uint8_t *p = buf;
+        size_t left = (size_t)n;
+        while (left) {
+            size_t used = parse_buf(&rd->ctx, p, left);
+            p += used;
+            left -= used;
+            if (!frame_ready(&rd->ctx)) continue;
+            if (rd->ctx.curr_cmd_len > uCOMMS_RING_SLOT_SIZE) {
+                atomic_fetch_add_explicit(&rd->ring.overruns, 1, memory_order_relaxed);
+                continue;
+            }
+
+            /// ? Give a briefly stalled consumer a chance before dropping.
+            int spins = uCOMMS_RING_FULL_SPINS;
+            while (ring_push(&rd->ring, frame_buf(&rd->ctx), rd->ctx.curr_cmd_len) != 0) {
+                if (spins-- == 0) {
+                    atomic_fetch_add_explicit(&rd->ring.overruns, 1, memory_order_relaxed);
+                    break;
+                }
+                thrd_yield();
+            }
+        }
+    }
+}
+
+// Starts a reader thread on an open port.
+// The reader struct is large and cache-line aligned (the ring is inline), use
+// static storage or aligned_alloc() rather than the stack.
+// Returns 0, or -1 with errno set.
+int ucomms_reader_start(uCOMMS_READER *rd, int fd) {
+    CHECK_PTR(rd);
+    memset(rd, 0, sizeof(*rd));
+    rd->fd = fd;
+#if uCOMMS_RING_SLOT_SIZE > uCOMMS_CONTEXT_BUFFER_SIZE
+    attach_buffer(&rd->ctx, rd->frame, sizeof(rd->frame));
+#endif
+    rd->wake_fd = eventfd(0, EFD_CLOEXEC);
+    if (rd->wake_fd < 0) return -1;
+
+    if (thrd_create(&rd->thread, reader_main, rd) != thrd_success) {
+        close(rd->wake_fd);
+        errno = EAGAIN;
+        return -1;
+    }
+    return 0;
+}
+
+// Stops and joins the reader thread, the port fd is left open.
+// Frames still in the ring can be popped afterwards.
+void ucomms_reader_stop(uCOMMS_READER *rd) {
+    CHECK_PTR(rd);
+    uint64_t one = 1;
+    ERROR_CHECK((int)write(rd->wake_fd, &one, sizeof(one)), (int)sizeof(one));
+    thrd_join(rd->thread, NULL);
+    close(rd->wake_fd);
+}
+
+// Pops the oldest frame into a caller buffer of uCOMMS_RING_SLOT_SIZE bytes.
+// Returns the payload length, or -1 if no frame is waiting.
+int ucomms_reader_pop(uCOMMS_READER *rd, void *payload) {
+    const uCOMMS_FRAME_SLOT *slot = ring_peek(&rd->ring);
+    if (!slot) return -1;
+    int len = slot->len;
+    memcpy(payload, slot->payload, len);
+    ring_pop(&rd->ring);
+    return len;
+}
@@ -0,0 +1,123 @@
+/// ? Capture replay
+/// Feeds a log written by ucomms_capture_append() (see capture.h) back through
+/// parse_cmd(), byte by byte, exactly as the port saw it. By default it runs as
+/// fast as it can and reports parser throughput, --paced sleeps between
+/// records to reproduce the original timing.
+/// Only the received side is replayed unless --tx is given.
+
+/// C LIB HEADERS
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+/// LINUX HEADERS
+#include <unistd.h>
+#include "checks.h"
+#include "ucoms.h"       /// parse_cmd()
+#include "stats.h"       /// ucomms_now_ns()
+#include "capture.h"     /// log format, ucomms_capture_map()
+
+
+static const char *status_names[] = {
+    "ok", "no_start", "no_length", "length_mismatch", "overflow", "escape", "crc",
+};
+
+// Sleeps until the given time since start on CLOCK_MONOTONIC.
+// Returns 0, or the error clock_nanosleep() failed with (it does not set errno).
+int sleep_until(uint64_t start_ns, uint64_t time_us) {
+    uint64_t when = start_ns + time_us * 1000u;
+    struct timespec ts = {.tv_sec = (time_t)(when / 1000000000u), .tv_nsec = (long)(when % 1000000000u)};
+    int err;
+    while ((err = clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL)) == EINTR) {}
+    return err;
+}
+
+int main(int argc, char **argv) {
+    int paced = 0, tx = 0, verbose = 0, embedded = 0;
+    uint8_t crc_mode = uCOMMS_CRC_NONE;
+    const char *path = NULL;
+    for (int i = 1; i < argc; i++) {
+        if      (strcmp(argv[i], "--paced") == 0)    paced = 1;
+        else if (strcmp(argv[i], "--tx") == 0)       tx = 1;
+        else if (strcmp(argv[i], "--embedded") == 0) embedded = 1;
+        else if (strcmp(argv[i], "--crc16") == 0)    crc_mode = uCOMMS_CRC16;
+        else if (strcmp(argv[i], "--crc32c") == 0)   crc_mode = uCOMMS_CRC32C;
+        else if (strcmp(argv[i], "-v") == 0)         verbose = 1;
+        else if (!path && argv[i][0] != '-')         path = argv[i];
+        else {
+            path = NULL;
+            break;
+        }
+    }
+    if (!path) {
+        fprintf(stderr, "usage: %s [--paced] [--tx] [--embedded] [--crc16|--crc32c] [-v] capture.log\n", argv[0]);
+        return 2;
+    }
+
+    uCOMMS_CAPTURE_READER rd;
+    if (ucomms_capture_map(&rd, path) != 0) {
+        perror(path);
+        return 1;
+    }
+
+    // / One parser per stream and direction, made the first time it shows up.
+    // / By default frames can be as big as the protocol allows, --embedded
+    // / replays with the 64 byte comms_buf a small target has.
+    static uCOMMS_CONTEXT *ctx[uCOMMS_CAPTURE_STREAMS][2];
+
+    uint64_t bytes = 0, frames = 0, records = 0, errors[7] = {0};
+    uCOMMS_CAPTURE_RECORD rec;
+    int rc;
+    uint64_t replay_start = ucomms_now_ns();
+    uint64_t busy_ns = 0;
+    while ((rc = ucomms_capture_next(&rd, &rec)) == 1) {
+        if (rec.dir == uCOMMS_CAPTURE_TX && !tx) continue;
+        int err = paced ? sleep_until(replay_start, rec.time_us) : 0;
+        if (err) {
+            fprintf(stderr, "%s: clock_nanosleep: %s\n", path, strerror(err));
+            ucomms_capture_unmap(&rd);
+            return 1;
+        }
+        records++;
+
+        uCOMMS_CONTEXT *c = ctx[rec.stream][rec.dir];
+        if (!c) {
+            c = calloc(1, sizeof(*c) + (embedded ? 0 : uCOMMS_MAX_BUFFER_SIZE));
+            CHECK_PTR(c);
+            c->crc_mode = crc_mode;
+            if (!embedded) attach_buffer(c, (char *)(c + 1), uCOMMS_MAX_BUFFER_SIZE);
+            ctx[rec.stream][rec.dir] = c;
+        }
+        uint64_t t0 = ucomms_now_ns();
+        for (size_t i = 0; i < rec.len; i++) {
+            uCOMMS_PARSE_STATUS status = parse_cmd(c, (char)rec.data[i]);
+            if (status == PARSE_FRAME) {
+                frames++;
+                if (verbose) printf("%10.6f %u %s %.*s\n", rec.time_us / 1e6, rec.stream, rec.dir ? "tx" : "rx",
+                                    (int)c->curr_cmd_len, frame_buf(c));
+            } else if (status < 0) {
+                errors[-status]++;
+                if (verbose) printf("%10.6f %u %s error %s at byte %zu of record %llu\n", rec.time_us / 1e6, rec.stream,
+                                    rec.dir ? "tx" : "rx", status_names[-status], i, (unsigned long long)records);
+            }
+        }
+        busy_ns += ucomms_now_ns() - t0;
+        bytes += rec.len;
+    }
+    if (rc < 0) fprintf(stderr, "%s: log is truncated or corrupt after %llu records\n", path, (unsigned long long)records);
+
+    printf("records %llu\n", (unsigned long long)records);
+    printf("bytes %llu\n", (unsigned long long)bytes);
+    printf("frames %llu\n", (unsigned long long)frames);
+    for (int s = 1; s < 7; s++) printf("%s %llu\n", status_names[s], (unsigned long long)errors[s]);
+    printf("parse_ns_per_byte %.3f\n", bytes ? (double)busy_ns / (double)bytes : 0.0);
+    printf("parse_MB_per_s %.1f\n", busy_ns ? (double)bytes / ((double)busy_ns / 1e9) / 1e6 : 0.0);
+
+    for (int s = 0; s < uCOMMS_CAPTURE_STREAMS; s++) {
+        free(ctx[s][0]);
+        free(ctx[s][1]);
+    }
+    ucomms_capture_unmap(&rd);
+    return rc < 0 ? 1 : 0;
+}
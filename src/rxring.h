@@ -0,0 +1,246 @@
+#pragma once
+
+#include <errno.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <linux/memfd.h>     /// MFD_CLOEXEC, memfd_create() needs _GNU_SOURCE otherwise
+
+#include "checks.h"
+#include "ucoms.h"
+
+/// * Zero copy receive.
+/// * The port is read straight into a power of two ring and the parser runs
+/// * over the ring itself. Payloads are decoded in place: a payload without
+/// * escapes is never touched, an escaped one is shifted down over its own
+/// * escape bytes. Frames come out as views into the ring that stay valid
+/// * until the consumer releases them, in the order they came out.
+/// * With uCOMMS_RX_MIRROR the same pages are mapped twice back to back, so a
+/// * frame that wraps around the end is still contiguous. Without it (or when
+/// * the mapping fails) the first `window` bytes are copied behind the end as
+/// * they are read, which only costs something for the bytes that land there.
+/// *
+/// *     for (;;) {
+/// *         poll(fd);
+/// *         ucomms_rx_read(&rx, fd);
+/// *         while (ucomms_rx_next(&rx, &view)) { handle(view.ptr, view.len); ucomms_rx_release(&rx, &view); }
+/// *     }
+/// *
+/// * Views may be held across reads, the ring just stops reading (ENOBUFS)
+/// * once held frames fill it.
+
+#define uCOMMS_RX_MIRROR 0x01      /// ? Map the ring twice, see above.
+
+typedef struct {
+    const uint8_t *ptr;      /// ? Payload, NUL terminated like frame_buf().
+    size_t         len;
+    uint64_t       seq;      /// ? Release order.
+    uint64_t       end;      /// ? Ring position after the frame.
+} uCOMMS_RX_VIEW;
+
+typedef struct {
+    uint8_t *base;
+    size_t   size;           /// ? Power of two.
+    size_t   map_size;       /// ? Bytes mapped at base.
+    size_t   window;         /// ? Largest encoded frame, kept contiguous past the end.
+    uint8_t  mirrored;
+    uint64_t head;           /// ? Bytes read from the port so far.
+    uint64_t scan;           /// ? Bytes handed to the parser.
+    uint64_t tail;           /// ? Everything before this may be overwritten.
+    uint64_t anchor;         /// ? START_BYTE of the frame being parsed.
+    uint64_t emitted;        /// ? Views handed out.
+    uint64_t released;       /// ? Views handed back.
+    uint64_t full;           /// ? Reads refused because held frames filled the ring.
+    uCOMMS_CONTEXT ctx;      /// ? Set crc_mode and stats here, frames land in the ring.
+} uCOMMS_RX_RING;
+
+// Maps the ring twice through a memfd. Returns 0, or -1 with errno set.
+int rx_map_mirror(uCOMMS_RX_RING *rx) {
+    int fd = (int)syscall(SYS_memfd_create, "ucomms_rx", MFD_CLOEXEC);
+    if (fd < 0) return -1;
+
+    /// ? Reserve both halves first so nothing else can land in between.
+    uint8_t *base = MAP_FAILED;
+    if (ftruncate(fd, (off_t)rx->size) == 0) base = mmap(NULL, 2 * rx->size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (base != MAP_FAILED &&
+        (mmap(base, rx->size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED ||
+         mmap(base + rx->size, rx->size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED)) {
+        munmap(base, 2 * rx->size);
+        base = MAP_FAILED;
+    }
+    int err = errno;
+    close(fd);    /// ? The mappings keep the pages alive.
+    errno = err;
+    if (base == MAP_FAILED) return -1;
+
+    rx->base     = base;
+    rx->map_size = 2 * rx->size;
+    rx->mirrored = 1;
+    return 0;
+}
+
+// Sets up a ring of size bytes (a power of two) for payloads up to
+// max_payload bytes. flags is uCOMMS_RX_MIRROR or 0, a mirror that cannot be
+// mapped falls back to copying, see rx->mirrored.
+// Returns 0, or -1 with errno set.
+int ucomms_rx_init(uCOMMS_RX_RING *rx, size_t size, size_t max_payload, int flags) {
+    CHECK_PTR(rx);
+    CHECK((size && (size & (size - 1)) == 0), "ucomms_rx_init() size must be a power of two");
+    CHECK((max_payload + 2 <= uCOMMS_MAX_BUFFER_SIZE), "ucomms_rx_init() max_payload");
+    memset(rx, 0, sizeof(*rx));
+    rx->size = size;
+    /// ? START, a 3 byte length, payload and CRC all escaped, STOP.
+    rx->window = 2 * (max_payload + 2) + 16;
+    CHECK((size >= 2 * rx->window), "ucomms_rx_init() ring too small for max_payload");
+    rx->ctx.ext_cap = (uint16_t)(max_payload + 2);
+
+    if (!(flags & uCOMMS_RX_MIRROR) || size % (size_t)sysconf(_SC_PAGESIZE) != 0 || rx_map_mirror(rx) != 0) {
+        rx->map_size = size + rx->window;
+        void *base = mmap(NULL, rx->map_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (base == MAP_FAILED) return -1;
+        rx->base = base;
+    }
+    /// ? Frames land in the ring from the first one on, ucomms_rx_next() moves
+    /// ? ext_buf along. Without it the parser would check the first length
+    /// ? against the 64 byte comms_buf.
+    rx->ctx.ext_buf = (char *)rx->base;
+    return 0;
+}
+
+// Unmaps the ring, views still held become invalid.
+void ucomms_rx_close(uCOMMS_RX_RING *rx) {
+    CHECK_PTR(rx);
+    if (rx->base) munmap(rx->base, rx->map_size);
+    rx->base = NULL;
+}
+
+// Returns the bytes the ring can take before held frames are released.
+size_t ucomms_rx_space(const uCOMMS_RX_RING *rx) {
+    return rx->size - (size_t)(rx->head - rx->tail);
+}
+
+// Reads from fd straight into the ring.
+// Returns the bytes read, 0 at EOF, or -1 with errno set (ENOBUFS when held
+// frames fill the ring).
+ssize_t ucomms_rx_read(uCOMMS_RX_RING *rx, int fd) {
+    CHECK_PTR(rx);
+    size_t off  = (size_t)rx->head & (rx->size - 1);
+    size_t want = ucomms_rx_space(rx);
+    if (!rx->mirrored && want > rx->size - off) want = rx->size - off;
+    if (want == 0) {
+        rx->full++;
+        errno = ENOBUFS;
+        return -1;
+    }
+
+    ssize_t n = read(fd, rx->base + off, want);
+    if (n <= 0) return n;
+    /// ? Keep the copy behind the end in step with the start of the ring.
+    if (!rx->mirrored && off < rx->window) {
+        size_t dup = (size_t)n < rx->window - off ? (size_t)n : rx->window - off;
+        memcpy(rx->base + rx->size + off, rx->base + off, dup);
+    }
+    rx->head += (uint64_t)n;
+    return n;
+}
+
+// Lets go of bytes nobody holds: everything up to the frame in progress, or
+// up to what was scanned when there is none.
+void rx_trim(uCOMMS_RX_RING *rx) {
+    if (rx->emitted == rx->released) rx->tail = frame_open(&rx->ctx) ? rx->anchor : rx->scan;
+}
+
+// Returns the size of the (escaped) varint length at p, or 0 when it is not
+// all there yet or looks wrong, the parser then takes it a byte at a time.
+size_t rx_length_size(const uint8_t *p, size_t avail) {
+    for (size_t i = 0; i < avail && i < 6; ) {
+        uint8_t b = p[i++];
+        if (b == ESC_BYTE) {
+            if (i == avail) return 0;
+            b = p[i++] ^ uCOMMS_ESC_XOR;
+        } else if (IS_RESERVED_BYTE(b)) {
+            return 0;
+        }
+        if (!(b & 0x80)) return i;
+    }
+    return 0;
+}
+
+// Parses what has been read so far up to the next complete frame.
+// Returns 1 with a view into the ring, or 0 when more data is needed.
+int ucomms_rx_next(uCOMMS_RX_RING *rx, uCOMMS_RX_VIEW *view) {
+    CHECK_PTR(rx);
+    CHECK_PTR(view);
+    uCOMMS_CONTEXT *ctx = &rx->ctx;
+    size_t mask = rx->size - 1;
+
+    while (rx->scan != rx->head) {
+        size_t avail = (size_t)(rx->head - rx->scan);
+
+        if (!frame_open(ctx) || rx->base[(size_t)rx->scan & mask] == START_BYTE) {
+            /// ? Hunting, or a new START_BYTE cuts the frame short: feed up to
+            /// ? and including the next reserved byte, so a START_BYTE always
+            /// ? ends the chunk and the frame can be anchored on it.
+            const uint8_t *p = rx->base + ((size_t)rx->scan & mask);
+            size_t limit = (size_t)(rx->base + rx->map_size - p);
+            if (avail > limit) avail = limit;
+            size_t n = ucomms_find_special(p, avail);
+            if (n == avail || p[n] != START_BYTE) {
+                rx->scan += parse_buf(ctx, p, n < avail ? n + 1 : n);
+                rx_trim(rx);
+                continue;
+            }
+            /// ? Take the length along when it is all there, the payload then
+            /// ? starts right behind it.
+            size_t len_size = rx_length_size(p + n + 1, avail - n - 1);
+            rx->scan   += parse_buf(ctx, p, n + 1 + len_size);
+            rx->anchor  = rx->scan - 1 - len_size;
+            ctx->ext_buf = (char *)rx->base + ((size_t)rx->anchor & mask) + 1 + len_size;
+            rx_trim(rx);
+            continue;
+        }
+
+        /// ? Inside a frame: everything is addressed from its START_BYTE, which
+        /// ? keeps it contiguous through the wrap. The payload is written back
+        /// ? over the bytes it came from, never ahead of them.
+        /// ? A new START_BYTE always ends the chunk, see above.
+        size_t at = (size_t)(rx->scan - rx->anchor);
+        const uint8_t *p = rx->base + ((size_t)rx->anchor & mask) + at;
+        if (at >= rx->window) {
+            /// ? Cannot happen with a sane parser, an open frame that long has overflowed.
+            drop_frame(ctx, PARSE_ERR_OVERFLOW);
+            continue;
+        }
+        if (avail > rx->window - at) avail = rx->window - at;
+        int had_len = (ctx->comms_flags & (1 << LENGTH_BYTE_FLAG)) != 0;
+        const uint8_t *start = had_len ? memchr(p, START_BYTE, avail) : NULL;
+        /// ? The length goes a byte at a time, once it is known the payload is
+        /// ? decoded from where it already lies.
+        size_t n = !had_len ? 1 : start ? (size_t)(start - p) : avail;
+        rx->scan += parse_buf(ctx, p, n);
+        if (!had_len && frame_open(ctx) && (ctx->comms_flags & (1 << LENGTH_BYTE_FLAG))) ctx->ext_buf = (char *)p + 1;
+
+        if (frame_ready(ctx)) {
+            view->ptr = (const uint8_t *)ctx->ext_buf;
+            view->len = ctx->curr_cmd_len;
+            view->seq = rx->emitted++;
+            view->end = rx->scan;
+            return 1;
+        }
+        rx_trim(rx);
+    }
+    return 0;
+}
+
+// Hands a view back, views must be released in the order they came out.
+void ucomms_rx_release(uCOMMS_RX_RING *rx, const uCOMMS_RX_VIEW *view) {
+    CHECK_PTR(rx);
+    CHECK_PTR(view);
+    CHECK((view->seq == rx->released), "ucomms_rx_release() out of order");
+    rx->released++;
+    rx->tail = view->end;
+    rx_trim(rx);
+}
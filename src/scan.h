@@ -0,0 +1,76 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+/// * Bulk scanning for the reserved framing bytes.
+/// * START_BYTE (0x02), STOP_BYTE (0x03) and ESC_BYTE (0x10) are the only bytes
+/// * the parser has to look at one by one, everything in between can be copied
+/// * in a single run. These helpers find the next reserved byte as fast as the
+/// * target allows: AVX2, then SSE2, then 8 bytes at a time in a plain word.
+
+#define uCOMMS_SCAN_START 0x02
+#define uCOMMS_SCAN_STOP  0x03
+#define uCOMMS_SCAN_ESC   0x10
+
+/// ? Word-at-a-time fallback, works on any little-endian target.
+/// ? Standard "has zero byte" trick, the lowest flagged byte is always exact.
+#define uCOMMS_SWAR_ONES  0x0101010101010101ULL
+#define uCOMMS_SWAR_HIGHS 0x8080808080808080ULL
+#define uCOMMS_SWAR_ZERO(v) (((v) - uCOMMS_SWAR_ONES) & ~(v) & uCOMMS_SWAR_HIGHS)
+
+// Returns the index of the first reserved byte in p[0..n), or n if there is none.
+size_t ucomms_find_special(const uint8_t *p, size_t n) {
+    size_t i = 0;
+
+#if defined(__AVX2__)
+    const __m256i start32 = _mm256_set1_epi8(uCOMMS_SCAN_START);
+    const __m256i stop32  = _mm256_set1_epi8(uCOMMS_SCAN_STOP);
+    const __m256i esc32   = _mm256_set1_epi8(uCOMMS_SCAN_ESC);
+    for (; i + 32 <= n; i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(p + i));
+        __m256i hit = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(v, start32),
+                                                      _mm256_cmpeq_epi8(v, stop32)),
+                                      _mm256_cmpeq_epi8(v, esc32));
+        uint32_t mask = (uint32_t)_mm256_movemask_epi8(hit);
+        if (mask) return i + (size_t)__builtin_ctz(mask);
+    }
+#endif
+
+#if defined(__SSE2__)
+    const __m128i start16 = _mm_set1_epi8(uCOMMS_SCAN_START);
+    const __m128i stop16  = _mm_set1_epi8(uCOMMS_SCAN_STOP);
+    const __m128i esc16   = _mm_set1_epi8(uCOMMS_SCAN_ESC);
+    for (; i + 16 <= n; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(p + i));
+        __m128i hit = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, start16),
+                                                _mm_cmpeq_epi8(v, stop16)),
+                                   _mm_cmpeq_epi8(v, esc16));
+        uint32_t mask = (uint32_t)_mm_movemask_epi8(hit);
+        if (mask) return i + (size_t)__builtin_ctz(mask);
+    }
+#endif
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    for (; i + 8 <= n; i += 8) {
+        uint64_t v;
+        memcpy(&v, p + i, sizeof(v));
+        uint64_t mask = uCOMMS_SWAR_ZERO(v ^ (uCOMMS_SWAR_ONES * uCOMMS_SCAN_START))
+                      | uCOMMS_SWAR_ZERO(v ^ (uCOMMS_SWAR_ONES * uCOMMS_SCAN_STOP))
+                      | uCOMMS_SWAR_ZERO(v ^ (uCOMMS_SWAR_ONES * uCOMMS_SCAN_ESC));
+        if (mask) return i + (size_t)(__builtin_ctzll(mask) >> 3);
+    }
+#endif
+
+    for (; i < n; i++) {
+        if (p[i] == uCOMMS_SCAN_START || p[i] == uCOMMS_SCAN_STOP || p[i] == uCOMMS_SCAN_ESC) {
+            return i;
+        }
+    }
+    return n;
+}
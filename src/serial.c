@@ -14,73 +14,93 @@
 
 
 /// C LIB HEADERS
+#include <errno.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <time.h>
 /// LINUX HEADERS
-#include <fcntl.h>       /// Contains file controls like O_RWDR
-#include <termios.h>     /// contains POSIX terminal control definitions
 #include <unistd.h>      /// write(), read(), close()
 #include <threads.h>
 #include "checks.h"
+#include "ucoms.h"       /// START_BYTE, STOP_BYTE, ESC_BYTE and the parser
+#include "port.h"        /// ucomms_port_open(), termios setup
+#include "engine.h"      /// epoll loop over many ports, ucomms_port_send()
+#include "capture.h"     /// raw RX/TX log for ucomms_replay
 
 
-#define START_BYTE 0x02  // STX
-#define STOP_BYTE  0x03  // EXT
-#define ESC_BYTE   0x10  // ESC
+// Prints every frame a device sends back.
+void print_frame(uCOMMS_PORT *port, const uint8_t *payload, size_t len) {
+    printf("%s: %.*s\n", (const char *)port->user, (int)len, (const char *)payload);
+}
 
+int main(int argc, char **argv) {
+    // Before we can mess around with a serial port, we first have to open it.
+    // / Every port given on the command line is opened and configured, they all
+    // / share one epoll loop on this thread.
+    // / --capture FILE logs every byte in and out, replay it with ucomms_replay.
+    // / --baud N sets any rate the adapter can do, --rtscts turns on hardware
+    // / flow control, --low-latency asks the driver not to hold received bytes.
+    static uCOMMS_CAPTURE capture;
+    int capturing = 0;
+    uCOMMS_PORT_CONFIG cfg = uCOMMS_PORT_DEFAULTS;
+    while (argc > 1 && strncmp(argv[1], "--", 2) == 0) {
+        if (argc > 2 && strcmp(argv[1], "--capture") == 0) {
+            CHECK(ucomms_capture_open(&capture, argv[2]) == 0, "ucomms_capture_open()");
+            capturing = 1;
+        } else if (argc > 2 && strcmp(argv[1], "--baud") == 0) {
+            cfg.baud = (uint32_t)strtoul(argv[2], NULL, 10);
+            CHECK(cfg.baud > 0, "--baud");
+        } else if (strcmp(argv[1], "--rtscts") == 0) {
+            cfg.rtscts = 1;
+        } else if (strcmp(argv[1], "--low-latency") == 0) {
+            cfg.low_latency = 1;
+        } else {
+            fprintf(stderr, "usage: serial [--capture FILE] [--baud N] [--rtscts] [--low-latency] [PORT...]\n");
+            return 1;
+        }
+        int used = (strcmp(argv[1], "--capture") == 0 || strcmp(argv[1], "--baud") == 0) ? 2 : 1;
+        argc -= used;
+        argv += used;
+    }
 
-int main() {
-    // Before we can mess around with a serial port, we first have to open it
-    const char* port = "/dev/ttyUSB0";
-    int serial_port = open(port, O_RDWR);
-    CHECK_OPEN(serial_port > 0);
-
-    // / After successfully getting a handle to the serial port file, we can now
-    // / open and configure it, we need to create a new termios struct, and then
-    // / write the existing configuration of the serial port to it, before modifying
-    // / these parameters and then saving.
-    struct termios tty;
-    CHECK((tcgetattr(serial_port, &tty) == 0),"tcgetattr()");
-
-    // / Now we can modify tty's settings as needed
-    // / PARENB (Parity)
-    // / If this bit is set, generation and detection of the parity bit is enabled.
-    // / Most serial communications do not use a parity bit, s
-    tty.c_cflag &= ~PARENB;         // Clear parity bit.
-    tty.c_cflag &= ~CSTOPB;         // one stop bit.
-    tty.c_cflag &= ~CSIZE;          // clear all the size bits.
-    tty.c_cflag |=  CS8;            // 8 bits per byte.
-    tty.c_cflag |=  CREAD | CLOCAL; //Turn on read & ignore ctrl lines.
-    tty.c_lflag &= ~ICANON;         // disable canonical mode.
-    tty.c_lflag &= ~ECHO;           // disable echo.
-    tty.c_lflag &= ~ECHOE;          // disable erasure.
-    tty.c_lflag &= ~ECHONL;         // disable new-line echo.
-    tty.c_lflag &= ~ISIG;           // disable interpretation of INTR, QUIT and SUSP.
-    tty.c_iflag &= ~(IXON | IXOFF | IXANY); // No software flow control.
-    tty.c_iflag &= ~(IGNBRK | BRKINT | PARMRK | ISTRIP | INLCR | IGNCR | ICRNL); // Disable any special handling of received bytes
-    tty.c_oflag &= ~OPOST;           // Prevent special interpretation of output bytes.
-    tty.c_oflag &= ~ONLCR;           // Prevent conversion of newline to carriage return/line feed.
-    tty.c_cc[VMIN] = 1;              // Read at least 1 byte
-    tty.c_cc[VTIME] = 0;             // No timeout.
-
-    cfsetispeed(&tty, B9600);        // set in baud rate.
-    cfsetospeed(&tty, B9600);        // set out baud rate.
+    const char *default_port = "/dev/ttyUSB0";
+    const char **ports = argc > 1 ? (const char **)argv + 1 : &default_port;
+    int nports = argc > 1 ? argc - 1 : 1;
 
-    // / We can now save our new serial port setting s and check for any errors:
-    CHECK(tcsetattr(serial_port, TCSANOW, &tty) == 0, "tcsetattr()");
-    
-    // / At this point, we can now read and write to the serial port :)
-    // / to write to the serial port, we use write()
-    // / reading is done with read(), but we have to provide a buffer for our os to write
-    // / the data into.
-    
+    uCOMMS_ENGINE eng;
+    CHECK(ucomms_engine_init(&eng) == 0, "ucomms_engine_init()");
+    for (int i = 0; i < nports; i++) {
+        int fd = ucomms_port_open_config(ports[i], &cfg);
+        CHECK_OPEN(fd >= 0);
+        uCOMMS_PORT *port = ucomms_engine_add_port(&eng, fd, print_frame, (void *)ports[i]);
+        CHECK(port != NULL, "ucomms_engine_add_port()");
+        if (capturing) ucomms_port_capture(port, &capture, (uint8_t)i);
+    }
 
+    // / At this point, we can now read and write to the serial ports :)
     // / for now lets just keep sending a true value, we will use this to toggle the on board led of the uno.
-
-    for (;;) {
-        char msg[] = {START_BYTE, 6, 'T', 'O', 'G', 'G', 'L', 'E', STOP_BYTE};
-        printf("Toggling on-board led\n");
-        write(serial_port, msg, sizeof(msg));
-        sleep(1);
+    // / Replies are handled by the engine in between, it also flushes the queued toggles.
+    // / A port that hangs up is removed by the engine, we are done once all of them are.
+    time_t last = 0;
+    while (eng.count) {
+        if (time(NULL) != last) {
+            last = time(NULL);
+            printf("Toggling on-board led\n");
+            for (int i = 0; i < uCOMMS_MAX_PORTS; i++) {
+                if (eng.ports[i].fd < 0) continue;
+                /// ? EAGAIN: the port has not taken the last toggles yet, skip this one.
+                if (ucomms_port_send(&eng.ports[i], "TOGGLE", 6, 0) != 0) {
+                    fprintf(stderr, "%s: %s\n", (const char *)eng.ports[i].user,
+                            errno == EAGAIN ? "busy, toggle skipped" : strerror(errno));
+                }
+            }
+        }
+        CHECK(ucomms_engine_poll(&eng, 1000) >= 0, "ucomms_engine_poll()");
     }
-}
\ No newline at end of file
+
+    printf("All ports closed\n");
+    ucomms_engine_close(&eng);
+    if (capturing) ucomms_capture_close(&capture);
+    return 0;
+}
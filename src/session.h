@@ -0,0 +1,260 @@
+#pragma once
+
+#include <errno.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+#include "checks.h"
+#include "ucoms.h"
+#include "frame.h"
+#include "tx.h"
+#include "txq.h"
+#include "stats.h"
+#include "capture.h"
+
+/// * Pipelined request/response.
+/// * Every request payload is prefixed with a sequence byte, the device copies
+/// * it into the first byte of its reply. Up to `window` requests are in flight
+/// * at once and replies can come back in any order.
+/// * The window slides like selective repeat: a new request needs
+/// * next_seq - base < window, base being the oldest request still waiting.
+/// * Each request has its own deadline, a single timerfd is armed for the
+/// * earliest one. When it fires only the requests that timed out are sent
+/// * again, up to max_retries times, then they complete with ETIMEDOUT.
+/// *
+/// *     request  {START_BYTE, MSG_LEN, SEQ, COMMAND, STOP_BYTE}
+/// *     reply    {START_BYTE, MSG_LEN, SEQ, ANSWER,  STOP_BYTE}
+/// *
+/// * Poll ucomms_session_timer_fd() for POLLIN next to the port, hand it to
+/// * ucomms_session_on_timer() and every frame read from the port to
+/// * ucomms_session_on_frame().
+/// * On its own the session writes fd and waits until the port takes each
+/// * request, like ucomms_send(). On an engine port it goes through the port's
+/// * transmit queue instead (ucomms_session_queue()), so it never blocks the
+/// * engine and never writes in the middle of another frame.
+
+#define uCOMMS_MAX_WINDOW       32    /// ? Requests in flight per session, a power of 2 below 128.
+#define uCOMMS_MAX_REQUEST      (uCOMMS_MAX_PAYLOAD - 1)   /// ? Request payload, the sequence byte takes one.
+
+/// ? status is 0 with the reply payload (sequence byte stripped), or ETIMEDOUT
+/// ? with no payload. The reply is only valid until the handler returns.
+typedef void (*uCOMMS_REPLY_HANDLER)(void *user, int status, const uint8_t *reply, size_t len);
+
+typedef struct {
+    uint8_t  pending;        /// ? Waiting for a reply.
+    uint8_t  seq;
+    uint8_t  retries;        /// ? Retransmits so far.
+    uint8_t  len;            /// ? Bytes in frame, sequence byte included.
+    uint64_t sent_ns;        /// ? CLOCK_MONOTONIC, last attempt.
+    uint64_t deadline_ns;
+    uCOMMS_REPLY_HANDLER on_reply;
+    void    *user;
+    uint8_t  frame[uCOMMS_MAX_PAYLOAD];   /// ? Copy of the payload, kept for retransmits.
+} uCOMMS_REQUEST;
+
+typedef struct {
+    int      fd;             /// ? Port the requests go out on.
+    int      timer_fd;
+    uint8_t  crc_mode;       /// ? uCOMMS_CRC_MODE of the port.
+    uint8_t  window;         /// ? Requests allowed in flight, 1 to uCOMMS_MAX_WINDOW.
+    uint8_t  base;           /// ? Oldest sequence number still pending.
+    uint8_t  next_seq;
+    uint8_t  max_retries;
+    uint32_t timeout_ms;     /// ? Per attempt.
+    uint32_t retransmits;
+    uint32_t timeouts;       /// ? Requests that ran out of retries.
+    uint32_t stale_replies;  /// ? Duplicates and replies to nothing we sent.
+    uCOMMS_STATS *stats;     /// ? Gets rtt_ns, and frames_out and bytes_out without a queue, optional.
+    uCOMMS_TXQ *txq;         /// ? Queue requests go through, see ucomms_session_queue().
+    uCOMMS_CAPTURE *capture; /// ? Raw TX log, see ucomms_session_capture().
+    uint8_t  capture_stream;
+    uCOMMS_REQUEST slots[uCOMMS_MAX_WINDOW];   /// ? Indexed by seq % uCOMMS_MAX_WINDOW.
+} uCOMMS_SESSION;
+
+// Sets up a session on an open port. Returns 0, or -1 with errno set.
+int ucomms_session_init(uCOMMS_SESSION *s, int fd, uint8_t window, uint32_t timeout_ms, uint8_t max_retries) {
+    CHECK_PTR(s);
+    CHECK((window >= 1 && window <= uCOMMS_MAX_WINDOW), "ucomms_session_init() window");
+    memset(s, 0, sizeof(*s));
+    s->fd          = fd;
+    s->window      = window;
+    s->timeout_ms  = timeout_ms;
+    s->max_retries = max_retries;
+    s->timer_fd    = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    return s->timer_fd < 0 ? -1 : 0;
+}
+
+// Closes the timer, pending requests are forgotten without a callback.
+void ucomms_session_close(uCOMMS_SESSION *s) {
+    CHECK_PTR(s);
+    if (s->timer_fd >= 0) close(s->timer_fd);
+    s->timer_fd = -1;
+}
+
+// Logs every request put on the wire, retransmits included, as TX records of
+// one stream of cap, like ucomms_port_capture(). NULL stops. Not used with
+// ucomms_session_queue(), the queue logs what it sends.
+void ucomms_session_capture(uCOMMS_SESSION *s, uCOMMS_CAPTURE *cap, uint8_t stream) {
+    CHECK_PTR(s);
+    s->capture        = cap;
+    s->capture_stream = stream;
+}
+
+// Sends requests through a transmit queue, an engine port's port->txq, instead
+// of writing fd. They are flushed right away, framed with the queue's CRC mode,
+// and counted and logged by the queue. NULL goes back to writing fd.
+void ucomms_session_queue(uCOMMS_SESSION *s, uCOMMS_TXQ *q) {
+    CHECK_PTR(s);
+    s->txq = q;
+}
+
+// Returns the fd to poll for POLLIN, see ucomms_session_on_timer().
+int ucomms_session_timer_fd(const uCOMMS_SESSION *s) {
+    return s->timer_fd;
+}
+
+// Returns the number of requests waiting for a reply.
+size_t ucomms_session_in_flight(const uCOMMS_SESSION *s) {
+    size_t n = 0;
+    for (uint8_t seq = s->base; seq != s->next_seq; seq++) n += s->slots[seq % uCOMMS_MAX_WINDOW].pending;
+    return n;
+}
+
+// Arms the timer for the earliest deadline, or disarms it.
+void session_arm(uCOMMS_SESSION *s) {
+    uint64_t first = 0;
+    for (uint8_t seq = s->base; seq != s->next_seq; seq++) {
+        const uCOMMS_REQUEST *req = &s->slots[seq % uCOMMS_MAX_WINDOW];
+        if (req->pending && (!first || req->deadline_ns < first)) first = req->deadline_ns;
+    }
+    /// ? An all zero it_value disarms, an absolute time of 0 would too.
+    struct itimerspec its = {0};
+    if (first) {
+        its.it_value.tv_sec  = (time_t)(first / 1000000000u);
+        its.it_value.tv_nsec = (long)(first % 1000000000u);
+    }
+    timerfd_settime(s->timer_fd, TFD_TIMER_ABSTIME, &its, NULL);
+}
+
+// Moves base past every request that has completed.
+void session_slide(uCOMMS_SESSION *s) {
+    while (s->base != s->next_seq && !s->slots[s->base % uCOMMS_MAX_WINDOW].pending) s->base++;
+}
+
+// Puts one attempt of a request on the wire and restarts its deadline.
+// Returns 0, or -1 with errno set, EAGAIN when the queue has no room for it.
+int session_transmit(uCOMMS_SESSION *s, uCOMMS_REQUEST *req) {
+    req->sent_ns     = ucomms_now_ns();
+    req->deadline_ns = req->sent_ns + (uint64_t)s->timeout_ms * 1000000u;
+    if (s->txq) return ucomms_txq_send(s->txq, req->frame, req->len, uCOMMS_TX_URGENT);
+    /// ? Requests are small, encoding one is cheaper than a writev() per run
+    /// ? and gives stats and capture the exact bytes.
+    uint8_t wire[uCOMMS_ENCODED_MAX(uCOMMS_MAX_PAYLOAD)];
+    size_t  n = encode_frame_crc(s->crc_mode, req->frame, req->len, wire, sizeof(wire));
+    if (s->stats) {
+        s->stats->frames_out++;
+        s->stats->bytes_out += n;
+    }
+    if (s->capture) ucomms_capture_append(s->capture, s->capture_stream, uCOMMS_CAPTURE_TX, wire, n);
+    struct iovec iov = {.iov_base = wire, .iov_len = n};
+    return writev_all(s->fd, &iov, 1);
+}
+
+// Sends a request, on_reply runs once with the reply or ETIMEDOUT.
+// Returns the sequence number, or -1 with errno set: EAGAIN when the window or
+// the queue is full, EMSGSIZE above uCOMMS_MAX_REQUEST, or whatever the write
+// failed with.
+int ucomms_session_request(uCOMMS_SESSION *s, const void *payload, size_t len, uCOMMS_REPLY_HANDLER on_reply, void *user) {
+    CHECK_PTR(s);
+    CHECK_PTR(on_reply);
+    if (len) CHECK_PTR(payload);
+    if (len > uCOMMS_MAX_REQUEST) {
+        errno = EMSGSIZE;
+        return -1;
+    }
+    if ((uint8_t)(s->next_seq - s->base) >= s->window) {
+        errno = EAGAIN;
+        return -1;
+    }
+
+    uint8_t seq = s->next_seq;
+    uCOMMS_REQUEST *req = &s->slots[seq % uCOMMS_MAX_WINDOW];
+    req->seq      = seq;
+    req->retries  = 0;
+    req->len      = (uint8_t)(len + 1);
+    req->on_reply = on_reply;
+    req->user     = user;
+    req->frame[0] = seq;
+    if (len) memcpy(req->frame + 1, payload, len);
+
+    if (session_transmit(s, req) < 0) return -1;
+    req->pending = 1;
+    s->next_seq++;
+    session_arm(s);
+    return seq;
+}
+
+// Completes a request, the slot is free again before the handler runs.
+void session_complete(uCOMMS_SESSION *s, uCOMMS_REQUEST *req, int status, const uint8_t *reply, size_t len) {
+    uCOMMS_REPLY_HANDLER on_reply = req->on_reply;
+    void *user = req->user;
+    req->pending = 0;
+    session_slide(s);
+    session_arm(s);
+    on_reply(user, status, reply, len);
+}
+
+// Matches a received frame with its request.
+// Returns 1 if it completed one, 0 for anything else (unsolicited or stale).
+int ucomms_session_on_frame(uCOMMS_SESSION *s, const uint8_t *payload, size_t len) {
+    CHECK_PTR(s);
+    if (len == 0) return 0;
+    CHECK_PTR(payload);
+
+    uint8_t seq = payload[0];
+    uCOMMS_REQUEST *req = &s->slots[seq % uCOMMS_MAX_WINDOW];
+    if ((uint8_t)(seq - s->base) >= (uint8_t)(s->next_seq - s->base) || !req->pending || req->seq != seq) {
+        s->stale_replies++;
+        return 0;
+    }
+    /// ? A reply to a retransmitted request could belong to any attempt.
+    if (s->stats && !req->retries) hist_record(&s->stats->rtt_ns, ucomms_now_ns() - req->sent_ns);
+    session_complete(s, req, 0, payload + 1, len - 1);
+    return 1;
+}
+
+// Handles an expired timer: requests past their deadline are sent again or
+// failed with ETIMEDOUT. A retransmit the queue has no room for counts as an
+// attempt lost on the wire. Returns the number of requests that were
+// retransmitted, or -1 with errno set if a retransmit could not be written.
+int ucomms_session_on_timer(uCOMMS_SESSION *s) {
+    CHECK_PTR(s);
+    uint64_t expirations;
+    if (read(s->timer_fd, &expirations, sizeof(expirations)) < 0 && errno != EAGAIN) return -1;
+
+    uint64_t now = ucomms_now_ns();
+    int resent = 0;
+    for (uint8_t seq = s->base; seq != s->next_seq; seq++) {
+        uCOMMS_REQUEST *req = &s->slots[seq % uCOMMS_MAX_WINDOW];
+        if (!req->pending || req->deadline_ns > now) continue;
+
+        if (req->retries < s->max_retries) {
+            req->retries++;
+            s->retransmits++;
+            if (session_transmit(s, req) < 0) {
+                if (errno == EAGAIN) continue;
+                return -1;
+            }
+            resent++;
+        } else {
+            s->timeouts++;
+            session_complete(s, req, ETIMEDOUT, NULL, 0);
+        }
+    }
+    session_arm(s);
+    return resent;
+}
@@ -0,0 +1,133 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+/// * Link statistics.
+/// * One uCOMMS_STATS per port, the parser, transmit queue and session update
+/// * it through a pointer they are given (NULL turns stats off). Every update is
+/// * a plain increment on the thread that owns the port, no locks and no
+/// * formatting. Readers take a ucomms_stats_snapshot() and format that.
+/// * A snapshot taken from another thread can be off by the updates racing it,
+/// * every counter only goes up so that is good enough for monitoring.
+
+/// * Histograms are HDR style: values below 8 get a bucket each, above that
+/// * every power of 2 is split in 8 linear sub-buckets, so any value is
+/// * recorded within 12.5% over the whole uint64_t range.
+#define uCOMMS_HIST_SUB      8
+#define uCOMMS_HIST_BUCKETS  ((64 - 2) * uCOMMS_HIST_SUB)
+
+typedef struct {
+    uint64_t count;
+    uint64_t sum;
+    uint64_t max;
+    uint32_t buckets[uCOMMS_HIST_BUCKETS];
+} uCOMMS_HIST;
+
+typedef struct {
+    uint64_t frames_in;
+    uint64_t bytes_in;          /// ? Everything the parser saw, noise included.
+    uint64_t frames_out;
+    uint64_t bytes_out;
+    uint64_t escapes;           /// ? ESC_BYTE sequences received.
+    uint32_t resyncs;           /// ? Frames dropped, any reason.
+    uint32_t no_start;          /// ? Drops by uCOMMS_PARSE_STATUS.
+    uint32_t no_length;
+    uint32_t length_mismatches;
+    uint32_t overflows;
+    uint32_t bad_escapes;
+    uint32_t crc_failures;
+    uint32_t truncated;         /// ? Frames cut short by the next START_BYTE.
+    uCOMMS_HIST parse_ns;       /// ? Time in the parse_buf() call that completed a frame.
+    uCOMMS_HIST rtt_ns;         /// ? Request to reply, first attempts only.
+} uCOMMS_STATS;
+
+// Returns CLOCK_MONOTONIC in nanoseconds.
+uint64_t ucomms_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+// Returns the bucket a value is counted in.
+size_t hist_bucket(uint64_t v) {
+    if (v < uCOMMS_HIST_SUB) return (size_t)v;
+    unsigned e = 63u - (unsigned)__builtin_clzll(v);
+    return (size_t)(e - 2) * uCOMMS_HIST_SUB + (size_t)((v >> (e - 3)) & (uCOMMS_HIST_SUB - 1));
+}
+
+// Returns the smallest value counted in a bucket.
+uint64_t hist_bucket_value(size_t b) {
+    if (b < uCOMMS_HIST_SUB) return b;
+    unsigned e = (unsigned)(b / uCOMMS_HIST_SUB) + 2;
+    return (uint64_t)(uCOMMS_HIST_SUB + b % uCOMMS_HIST_SUB) << (e - 3);
+}
+
+// Counts one value.
+void hist_record(uCOMMS_HIST *h, uint64_t v) {
+    h->buckets[hist_bucket(v)]++;
+    h->count++;
+    h->sum += v;
+    if (v > h->max) h->max = v;
+}
+
+// Returns the value at quantile q (0.5, 0.99, ...), the lower edge of its
+// bucket, or 0 for an empty histogram.
+uint64_t hist_quantile(const uCOMMS_HIST *h, double q) {
+    if (!h->count) return 0;
+    uint64_t rank = (uint64_t)(q * (double)h->count);
+    if (rank >= h->count) rank = h->count - 1;
+    uint64_t seen = 0;
+    for (size_t b = 0; b < uCOMMS_HIST_BUCKETS; b++) {
+        seen += h->buckets[b];
+        if (seen > rank) return hist_bucket_value(b);
+    }
+    return h->max;
+}
+
+// Copies the counters, see the note on threads above.
+void ucomms_stats_snapshot(const uCOMMS_STATS *stats, uCOMMS_STATS *out) {
+    memcpy(out, stats, sizeof(*out));
+}
+
+// Writes a snapshot as "name value" lines, histograms as count, mean, p50,
+// p99, p99.9 and max. Returns the length snprintf() would have needed.
+size_t ucomms_stats_format(const uCOMMS_STATS *s, char *buf, size_t cap) {
+    size_t n = 0;
+#define STATS_LINE(...) \
+    n += (size_t)snprintf(buf + (n < cap ? n : cap), n < cap ? cap - n : 0, __VA_ARGS__)
+
+    STATS_LINE("frames_in %llu\n",         (unsigned long long)s->frames_in);
+    STATS_LINE("bytes_in %llu\n",          (unsigned long long)s->bytes_in);
+    STATS_LINE("frames_out %llu\n",        (unsigned long long)s->frames_out);
+    STATS_LINE("bytes_out %llu\n",         (unsigned long long)s->bytes_out);
+    STATS_LINE("escapes %llu\n",           (unsigned long long)s->escapes);
+    STATS_LINE("resyncs %u\n",             s->resyncs);
+    STATS_LINE("no_start %u\n",            s->no_start);
+    STATS_LINE("no_length %u\n",           s->no_length);
+    STATS_LINE("length_mismatches %u\n",   s->length_mismatches);
+    STATS_LINE("overflows %u\n",           s->overflows);
+    STATS_LINE("bad_escapes %u\n",         s->bad_escapes);
+    STATS_LINE("crc_failures %u\n",        s->crc_failures);
+    STATS_LINE("truncated %u\n",           s->truncated);
+
+    const struct { const char *name; const uCOMMS_HIST *h; } hists[] = {
+        {"parse_ns", &s->parse_ns},
+        {"rtt_ns",   &s->rtt_ns},
+    };
+    for (size_t i = 0; i < sizeof(hists) / sizeof(hists[0]); i++) {
+        const uCOMMS_HIST *h = hists[i].h;
+        STATS_LINE("%s count=%llu mean=%llu p50=%llu p99=%llu p99.9=%llu max=%llu\n", hists[i].name,
+                   (unsigned long long)h->count,
+                   (unsigned long long)(h->count ? h->sum / h->count : 0),
+                   (unsigned long long)hist_quantile(h, 0.5),
+                   (unsigned long long)hist_quantile(h, 0.99),
+                   (unsigned long long)hist_quantile(h, 0.999),
+                   (unsigned long long)h->max);
+    }
+#undef STATS_LINE
+    return n;
+}
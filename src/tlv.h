@@ -0,0 +1,239 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "checks.h"
+#include "dispatch.h"    /// uCOMMS_VIEW
+
+/// * Binary payloads.
+/// * An integer opcode followed by type-length-value fields:
+/// *
+/// *     {OPCODE (varint), FIELD, FIELD, ...}
+/// *     FIELD = {KEY (varint, id << 3 | kind), VALUE}
+/// *
+/// * UINT and SINT values are varints (SINT zigzag encoded so small negative
+/// * numbers stay short), FIXED16/32/64 are little endian, BYTES is a varint
+/// * length and the bytes. Readers skip fields they do not know, so fields can
+/// * be added without breaking older peers.
+/// * The reader never copies: fields are decoded in place and BYTES come back
+/// * as a view into the frame.
+
+typedef enum {
+    uCOMMS_TLV_UINT    = 0,
+    uCOMMS_TLV_SINT    = 1,
+    uCOMMS_TLV_FIXED16 = 2,
+    uCOMMS_TLV_FIXED32 = 3,
+    uCOMMS_TLV_FIXED64 = 4,
+    uCOMMS_TLV_BYTES   = 5,
+} uCOMMS_TLV_KIND;
+
+/// ? Fixed layout structs travel as BYTES and are read in place, so they must
+/// ? be packed and the host little endian. uCOMMS_TLV_LAYOUT pins the size at
+/// ? compile time, a field added by mistake breaks the build, not the link.
+/// ? The rest of the format is byte order neutral, only declaring a layout
+/// ? needs a little endian host.
+#define uCOMMS_WIRE __attribute__((packed))
+#define uCOMMS_TLV_LAYOUT(type, size)                                              \
+    _Static_assert(sizeof(type) == (size), #type " wire size changed");            \
+    _Static_assert(_Alignof(type) == 1, #type " must be declared uCOMMS_WIRE");    \
+    _Static_assert(__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__, #type " is read in place as little endian")
+
+typedef struct {
+    uint8_t *buf;
+    size_t   cap;
+    size_t   len;
+    uint8_t  overflow;       /// ? Sticky, set by the first field that did not fit.
+} uCOMMS_TLV_WRITER;
+
+typedef struct {
+    const uint8_t *p;
+    const uint8_t *end;
+    uint32_t       opcode;
+} uCOMMS_TLV_READER;
+
+typedef struct {
+    uint32_t    id;
+    uint8_t     kind;        /// ? uCOMMS_TLV_KIND.
+    uint64_t    u;           /// ? UINT and FIXED values.
+    int64_t     i;           /// ? SINT values.
+    uCOMMS_VIEW bytes;       /// ? BYTES values, points into the frame.
+} uCOMMS_TLV_FIELD;
+
+
+/// * Writer
+
+// Appends raw bytes, or flags the writer if they do not fit.
+void tlv_put_raw(uCOMMS_TLV_WRITER *w, const void *p, size_t n) {
+    if (w->overflow || n > w->cap - w->len) {
+        w->overflow = 1;
+        return;
+    }
+    memcpy(w->buf + w->len, p, n);
+    w->len += n;
+}
+
+// Appends a LEB128 varint.
+void tlv_put_varint(uCOMMS_TLV_WRITER *w, uint64_t v) {
+    uint8_t tmp[10];
+    size_t  n = 0;
+    while (v >= 0x80) {
+        tmp[n++] = (uint8_t)(v | 0x80);
+        v >>= 7;
+    }
+    tmp[n++] = (uint8_t)v;
+    tlv_put_raw(w, tmp, n);
+}
+
+// Appends a field key.
+void tlv_put_key(uCOMMS_TLV_WRITER *w, uint32_t id, uCOMMS_TLV_KIND kind) {
+    tlv_put_varint(w, (uint64_t)id << 3 | kind);
+}
+
+// Appends the low n bytes of v, little endian.
+void tlv_put_le(uCOMMS_TLV_WRITER *w, uint64_t v, size_t n) {
+    uint8_t tmp[8];
+    for (size_t i = 0; i < n; i++) tmp[i] = (uint8_t)(v >> (8 * i));
+    tlv_put_raw(w, tmp, n);
+}
+
+// Starts a message with its opcode in buf.
+void tlv_begin(uCOMMS_TLV_WRITER *w, uint8_t *buf, size_t cap, uint32_t opcode) {
+    CHECK_PTR(w);
+    CHECK_PTR(buf);
+    w->buf      = buf;
+    w->cap      = cap;
+    w->len      = 0;
+    w->overflow = 0;
+    tlv_put_varint(w, opcode);
+}
+
+// Appends an unsigned varint field.
+void tlv_put_uint(uCOMMS_TLV_WRITER *w, uint32_t id, uint64_t v) {
+    tlv_put_key(w, id, uCOMMS_TLV_UINT);
+    tlv_put_varint(w, v);
+}
+
+// Appends a signed (zigzag) varint field.
+void tlv_put_sint(uCOMMS_TLV_WRITER *w, uint32_t id, int64_t v) {
+    tlv_put_key(w, id, uCOMMS_TLV_SINT);
+    tlv_put_varint(w, ((uint64_t)v << 1) ^ (uint64_t)(v >> 63));
+}
+
+// Appends fixed width fields.
+void tlv_put_u16(uCOMMS_TLV_WRITER *w, uint32_t id, uint16_t v) {
+    tlv_put_key(w, id, uCOMMS_TLV_FIXED16);
+    tlv_put_le(w, v, 2);
+}
+
+void tlv_put_u32(uCOMMS_TLV_WRITER *w, uint32_t id, uint32_t v) {
+    tlv_put_key(w, id, uCOMMS_TLV_FIXED32);
+    tlv_put_le(w, v, 4);
+}
+
+void tlv_put_u64(uCOMMS_TLV_WRITER *w, uint32_t id, uint64_t v) {
+    tlv_put_key(w, id, uCOMMS_TLV_FIXED64);
+    tlv_put_le(w, v, 8);
+}
+
+// Appends a length prefixed field.
+// Also used for uCOMMS_TLV_LAYOUT structs: tlv_put_bytes(w, id, &s, sizeof(s)).
+void tlv_put_bytes(uCOMMS_TLV_WRITER *w, uint32_t id, const void *p, size_t n) {
+    tlv_put_key(w, id, uCOMMS_TLV_BYTES);
+    tlv_put_varint(w, n);
+    tlv_put_raw(w, p, n);
+}
+
+// Returns the message size, or 0 if it did not fit the buffer.
+size_t tlv_end(const uCOMMS_TLV_WRITER *w) {
+    CHECK_PTR(w);
+    return w->overflow ? 0 : w->len;
+}
+
+
+/// * Reader
+
+// Reads a varint, returns 0 or -1 if it is cut short or too long.
+int tlv_get_varint(uCOMMS_TLV_READER *r, uint64_t *v) {
+    *v = 0;
+    for (unsigned shift = 0; r->p < r->end && shift < 64; shift += 7) {
+        uint8_t b = *r->p++;
+        *v |= (uint64_t)(b & 0x7F) << shift;
+        if (!(b & 0x80)) return 0;
+    }
+    return -1;
+}
+
+// Starts reading a received payload, the opcode lands in r->opcode.
+// Returns 0, or -1 if there is no valid opcode.
+int tlv_reader_init(uCOMMS_TLV_READER *r, const void *payload, size_t len) {
+    CHECK_PTR(r);
+    if (len) CHECK_PTR(payload);
+    r->p   = payload;
+    r->end = r->p + len;
+    uint64_t op;
+    if (tlv_get_varint(r, &op) < 0 || op > UINT32_MAX) return -1;
+    r->opcode = (uint32_t)op;
+    return 0;
+}
+
+// Decodes the next field in place.
+// Returns 1, 0 at the end of the payload, or -1 if the payload is malformed.
+int tlv_next(uCOMMS_TLV_READER *r, uCOMMS_TLV_FIELD *f) {
+    CHECK_PTR(r);
+    CHECK_PTR(f);
+    if (r->p == r->end) return 0;
+
+    uint64_t key;
+    if (tlv_get_varint(r, &key) < 0 || (key >> 3) > UINT32_MAX) return -1;
+    f->id   = (uint32_t)(key >> 3);
+    f->kind = (uint8_t)(key & 7);
+    f->u    = 0;
+    f->i    = 0;
+    f->bytes = (uCOMMS_VIEW){NULL, 0};
+
+    size_t fixed = 0;
+    switch (f->kind) {
+        case uCOMMS_TLV_UINT:
+            return tlv_get_varint(r, &f->u) < 0 ? -1 : 1;
+        case uCOMMS_TLV_SINT:
+            if (tlv_get_varint(r, &f->u) < 0) return -1;
+            f->i = (int64_t)(f->u >> 1) ^ -(int64_t)(f->u & 1);
+            return 1;
+        case uCOMMS_TLV_FIXED16: fixed = 2; break;
+        case uCOMMS_TLV_FIXED32: fixed = 4; break;
+        case uCOMMS_TLV_FIXED64: fixed = 8; break;
+        case uCOMMS_TLV_BYTES: {
+            uint64_t n;
+            if (tlv_get_varint(r, &n) < 0 || n > (uint64_t)(r->end - r->p)) return -1;
+            f->bytes = (uCOMMS_VIEW){(const char *)r->p, (size_t)n};
+            r->p += n;
+            return 1;
+        }
+        default:
+            return -1;    /// ? Unknown kinds cannot be skipped.
+    }
+
+    if (fixed > (size_t)(r->end - r->p)) return -1;
+    for (size_t i = 0; i < fixed; i++) f->u |= (uint64_t)r->p[i] << (8 * i);
+    r->p += fixed;
+    return 1;
+}
+
+// Finds a field by id from the start of a payload.
+// Returns 1, 0 if it is not there, or -1 if the payload is malformed.
+int tlv_find(const void *payload, size_t len, uint32_t id, uCOMMS_TLV_FIELD *f) {
+    uCOMMS_TLV_READER r;
+    if (tlv_reader_init(&r, payload, len) < 0) return -1;
+    int rc;
+    while ((rc = tlv_next(&r, f)) == 1) {
+        if (f->id == id) return 1;
+    }
+    return rc;
+}
+
+// Returns a BYTES field as a pointer to a uCOMMS_TLV_LAYOUT struct, in place,
+// or NULL if the field is not BYTES of exactly that size.
+#define tlv_layout(f, type) \
+    ((f)->kind == uCOMMS_TLV_BYTES && (f)->bytes.len == sizeof(type) ? (const type *)(const void *)(f)->bytes.ptr : NULL)
@@ -0,0 +1,161 @@
+#pragma once
+
+#include <errno.h>
+#include <poll.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/uio.h>     /// writev() and struct iovec
+
+#include "checks.h"
+#include "scan.h"
+#include "ucoms.h"
+#include "frame.h"
+
+/// * Transmit path.
+/// * A frame goes out as an iovec list: header, the payload itself, STOP_BYTE.
+/// * Reserved payload bytes split the payload into runs with a 2 byte escape
+/// * pair in between, so the payload is never copied, escaped or not.
+
+/// ? iovecs gathered before a writev(), comfortably below IOV_MAX.
+#define uCOMMS_SEND_IOV 64
+
+typedef struct {
+    struct iovec iov[uCOMMS_SEND_IOV];
+    uint8_t      hdr[uCOMMS_SEND_IOV][8];   /// ? Frame headers and CRC trailers, indexed by iov slot.
+    int          cnt;
+    int          fd;
+    uint8_t      crc_mode;                  /// ? uCOMMS_CRC_MODE of the port.
+} uCOMMS_TX;
+
+/// ? Escape pairs and STOP_BYTE live here so iovecs can point at them.
+static const uint8_t ucomms_esc_pairs[3][2] = {
+    {ESC_BYTE, START_BYTE ^ uCOMMS_ESC_XOR},
+    {ESC_BYTE, STOP_BYTE  ^ uCOMMS_ESC_XOR},
+    {ESC_BYTE, ESC_BYTE   ^ uCOMMS_ESC_XOR},
+};
+static const uint8_t ucomms_stop_byte = STOP_BYTE;
+
+// Returns the escape pair for a reserved byte.
+const uint8_t *esc_pair(uint8_t b) {
+    return ucomms_esc_pairs[b == START_BYTE ? 0 : (b == STOP_BYTE ? 1 : 2)];
+}
+
+// Writes as much of the iovecs as fd takes without blocking, retrying on
+// partial writes and EINTR. *iov and *cnt are advanced past what went out.
+// Returns the bytes written, or -1 with errno set.
+ssize_t writev_some(int fd, struct iovec **iov, int *cnt) {
+    size_t total = 0;
+    while (*cnt > 0) {
+        ssize_t n = writev(fd, *iov, *cnt);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+            return -1;
+        }
+        total += (size_t)n;
+
+        /// ? Partial write, skip what went out and go again.
+        size_t done = (size_t)n;
+        while (*cnt > 0 && done >= (*iov)->iov_len) {
+            done -= (*iov)->iov_len;
+            (*iov)++;
+            (*cnt)--;
+        }
+        if (*cnt > 0) {
+            (*iov)->iov_base = (uint8_t *)(*iov)->iov_base + done;
+            (*iov)->iov_len -= done;
+        }
+    }
+    return (ssize_t)total;
+}
+
+// Writes every iovec, waiting for POLLOUT when a non-blocking fd is full.
+// Only for callers that may block, an event loop wants writev_some().
+// The iovec array is consumed. Returns 0, or -1 with errno set.
+int writev_all(int fd, struct iovec *iov, int cnt) {
+    while (cnt > 0) {
+        if (writev_some(fd, &iov, &cnt) < 0) return -1;
+        if (cnt == 0) break;
+        /// ? Non-blocking port with a full tx buffer, wait until it drains.
+        struct pollfd pfd = {.fd = fd, .events = POLLOUT};
+        if (poll(&pfd, 1, -1) < 0 && errno != EINTR) return -1;
+    }
+    return 0;
+}
+
+// Sends everything gathered so far. Returns 0, or -1 with errno set.
+int tx_flush(uCOMMS_TX *tx) {
+    int rc = writev_all(tx->fd, tx->iov, tx->cnt);
+    tx->cnt = 0;
+    return rc;
+}
+
+// Appends one iovec, flushing first when the list is full.
+int tx_push(uCOMMS_TX *tx, const void *base, size_t len) {
+    if (len == 0) return 0;
+    if (tx->cnt == uCOMMS_SEND_IOV && tx_flush(tx) < 0) return -1;
+    tx->iov[tx->cnt].iov_base = (void *)base;
+    tx->iov[tx->cnt].iov_len  = len;
+    tx->cnt++;
+    return 0;
+}
+
+// Appends one frame. Returns 0, or -1 with errno set.
+int tx_frame(uCOMMS_TX *tx, const uint8_t *payload, size_t len) {
+    if (len > uCOMMS_MAX_FRAME_PAYLOAD) {
+        errno = EMSGSIZE;
+        return -1;
+    }
+
+    /// ? The header is copied into the slot it will occupy.
+    if (tx->cnt == uCOMMS_SEND_IOV && tx_flush(tx) < 0) return -1;
+    uint8_t *hdr = tx->hdr[tx->cnt];
+    hdr[0] = START_BYTE;
+    if (tx_push(tx, hdr, 1 + encode_length(len, hdr + 1)) < 0) return -1;
+
+    size_t i = 0;
+    while (i < len) {
+        size_t run = ucomms_find_special(payload + i, len - i);
+        if (tx_push(tx, payload + i, run) < 0) return -1;
+        i += run;
+        if (i == len) break;
+        if (tx_push(tx, esc_pair(payload[i]), 2) < 0) return -1;
+        i++;
+    }
+
+    if (tx->crc_mode) {
+        if (tx->cnt == uCOMMS_SEND_IOV && tx_flush(tx) < 0) return -1;
+        uint8_t *trailer = tx->hdr[tx->cnt];
+        if (tx_push(tx, trailer, encode_crc_trailer(tx->crc_mode, payload, len, trailer)) < 0) return -1;
+    }
+    return tx_push(tx, &ucomms_stop_byte, 1);
+}
+
+// Sends one frame on a port without copying the payload.
+// Returns 0, or -1 with errno set (EMSGSIZE above uCOMMS_MAX_FRAME_PAYLOAD).
+int ucomms_send(int port, const void *payload, size_t len) {
+    if (len) CHECK_PTR(payload);
+    uCOMMS_TX tx = {.fd = port};
+    if (tx_frame(&tx, payload, len) < 0) return -1;
+    return tx_flush(&tx);
+}
+
+// Same as ucomms_send() with a uCOMMS_CRC_MODE trailer.
+int ucomms_send_crc(int port, uint8_t crc_mode, const void *payload, size_t len) {
+    if (len) CHECK_PTR(payload);
+    uCOMMS_TX tx = {.fd = port, .crc_mode = crc_mode};
+    if (tx_frame(&tx, payload, len) < 0) return -1;
+    return tx_flush(&tx);
+}
+
+// Sends many frames, as few writev() calls as uCOMMS_SEND_IOV allows.
+// Returns 0, or -1 with errno set. Frames before a failing one may have been sent.
+// For a CRC trailer fill a uCOMMS_TX with crc_mode set and use tx_frame()/tx_flush().
+int ucomms_send_batch(int port, const struct iovec *frames, size_t count) {
+    CHECK_PTR(frames);
+    uCOMMS_TX tx = {.fd = port};
+    for (size_t i = 0; i < count; i++) {
+        if (tx_frame(&tx, frames[i].iov_base, frames[i].iov_len) < 0) return -1;
+    }
+    return tx_flush(&tx);
+}
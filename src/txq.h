@@ -0,0 +1,234 @@
+#pragma once
+
+#include <errno.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/uio.h>
+
+#include "checks.h"
+#include "ucoms.h"
+#include "frame.h"
+#include "tx.h"
+#include "stats.h"
+#include "capture.h"
+
+/// * Coalescing transmit queue.
+/// * Frames are encoded back to back into one buffer and written with a single
+/// * syscall when the first of three limits is hit: max_bytes queued,
+/// * max_frames queued, or max_delay_us since the oldest queued frame (Nagle
+/// * style). The delay is only noticed when ucomms_txq_poll() runs, sleep with
+/// * ucomms_txq_timeout_ms() so it runs on time. uCOMMS_TX_URGENT frames flush
+/// * straight away, together with whatever is queued ahead of them.
+/// * Writes never block: what the port does not take stays at the front of
+/// * the buffer, new frames queue up behind it. While ucomms_txq_pending() is
+/// * not 0 wait for POLLOUT and call ucomms_txq_resume(), the engine does.
+
+#ifndef uCOMMS_TXQ_SIZE
+#define uCOMMS_TXQ_SIZE      1024    /// ? Queue buffer, frames that never fit go out on their own.
+#endif
+#define uCOMMS_TXQ_HIST      9       /// ? Frames per flush buckets: 1, 2-3, 4-7, ... 256+.
+
+typedef enum {
+    uCOMMS_TX_URGENT = 1 << 0,     /// ? Flush now, do not wait for more frames.
+} uCOMMS_TX_FLAGS;
+
+typedef enum {
+    uCOMMS_FLUSH_BYTES    = 0,     /// ? max_bytes reached, or the next frame did not fit.
+    uCOMMS_FLUSH_FRAMES   = 1,     /// ? max_frames reached.
+    uCOMMS_FLUSH_DEADLINE = 2,     /// ? Oldest frame waited max_delay_us.
+    uCOMMS_FLUSH_URGENT   = 3,     /// ? uCOMMS_TX_URGENT frame.
+    uCOMMS_FLUSH_MANUAL   = 4,     /// ? ucomms_txq_flush().
+    uCOMMS_FLUSH_REASONS  = 5,
+} uCOMMS_FLUSH_REASON;
+
+typedef struct {
+    int      fd;
+    uint8_t  crc_mode;            /// ? uCOMMS_CRC_MODE of the port.
+    size_t   max_bytes;           /// ? Tunables, change them any time.
+    uint16_t max_frames;
+    uint32_t max_delay_us;        /// ? 0 sends every frame as it is queued.
+    size_t   used;                /// ? Bytes in buf, out included.
+    size_t   out;                 /// ? Flushed bytes at the front of buf the port has not taken yet.
+    uint16_t queued;              /// ? Frames in buf behind out.
+    uint64_t deadline_ns;         /// ? CLOCK_MONOTONIC, valid while queued.
+    uint64_t frames_sent;
+    uint64_t bytes_sent;
+    uint32_t flushes[uCOMMS_FLUSH_REASONS];
+    uint32_t frames_per_flush[uCOMMS_TXQ_HIST];   /// ? Flushes by log2 of the frames they carried.
+    uCOMMS_STATS *stats;          /// ? Link statistics, optional.
+    uCOMMS_CAPTURE *capture;      /// ? Raw TX log, optional.
+    uint8_t  capture_stream;
+    uint8_t *big;                 /// ? Frames that never fit in buf are encoded here, kept for the next one.
+    size_t   big_cap;
+    size_t   big_len;             /// ? Oversized frame still going out, from big_off on, ahead of buf.
+    size_t   big_off;
+    uint8_t  buf[uCOMMS_TXQ_SIZE];
+} uCOMMS_TXQ;
+
+// Sets up an empty queue with default limits: a full buffer, 32 frames or 1ms.
+void ucomms_txq_init(uCOMMS_TXQ *q, int fd, uint8_t crc_mode) {
+    CHECK_PTR(q);
+    memset(q, 0, offsetof(uCOMMS_TXQ, buf));
+    q->fd           = fd;
+    q->crc_mode     = crc_mode;
+    q->max_bytes    = uCOMMS_TXQ_SIZE;
+    q->max_frames   = 32;
+    q->max_delay_us = 1000;
+}
+
+// Frees what the queue allocated for oversized frames, queued frames are dropped.
+void ucomms_txq_close(uCOMMS_TXQ *q) {
+    CHECK_PTR(q);
+    free(q->big);
+    q->big     = NULL;
+    q->big_cap = 0;
+    q->big_len = 0;
+    q->big_off = 0;
+    q->used    = 0;
+    q->out     = 0;
+    q->queued  = 0;
+}
+
+// Returns the bytes flushed but not taken by the port yet.
+size_t ucomms_txq_pending(const uCOMMS_TXQ *q) {
+    return q->out + (q->big_len - q->big_off);
+}
+
+// Hands the port what was flushed, as far as it takes it without blocking.
+// Returns 0, or -1 with errno set, the flushed bytes are dropped then.
+int txq_write(uCOMMS_TXQ *q) {
+    struct iovec iov[2], *v = iov;
+    int cnt = 0;
+    size_t big_left = q->big_len - q->big_off;
+    if (big_left) iov[cnt++] = (struct iovec){.iov_base = q->big + q->big_off, .iov_len = big_left};
+    if (q->out)   iov[cnt++] = (struct iovec){.iov_base = q->buf, .iov_len = q->out};
+    if (!cnt) return 0;
+
+    ssize_t n = writev_some(q->fd, &v, &cnt);
+    size_t done = n < 0 ? big_left + q->out : (size_t)n;
+    size_t from_big = done < big_left ? done : big_left;
+    q->big_off += from_big;
+    if (q->big_off == q->big_len) q->big_off = q->big_len = 0;
+    done -= from_big;
+    if (done) {
+        memmove(q->buf, q->buf + done, q->used - done);
+        q->used -= done;
+        q->out  -= done;
+    }
+    return n < 0 ? -1 : 0;
+}
+
+
+// Flushes everything queued and writes what the port takes.
+// Returns 0, or -1 with errno set, the flushed bytes are dropped then.
+int txq_flush(uCOMMS_TXQ *q, uCOMMS_FLUSH_REASON reason) {
+    if (!q->queued) return txq_write(q);
+
+    size_t bucket = 0;
+    while (bucket + 1 < uCOMMS_TXQ_HIST && (q->queued >> (bucket + 1))) bucket++;
+    q->frames_per_flush[bucket]++;
+    q->flushes[reason]++;
+    size_t bytes = q->used - q->out;
+    q->frames_sent += q->queued;
+    q->bytes_sent  += bytes;
+    if (q->stats) {
+        q->stats->frames_out += q->queued;
+        q->stats->bytes_out  += bytes;
+    }
+
+    if (q->capture) ucomms_capture_append(q->capture, q->capture_stream, uCOMMS_CAPTURE_TX, q->buf + q->out, bytes);
+
+    q->out    = q->used;
+    q->queued = 0;
+    return txq_write(q);
+}
+
+// Sends whatever is queued now, as far as the port takes it.
+int ucomms_txq_flush(uCOMMS_TXQ *q) {
+    CHECK_PTR(q);
+    return txq_flush(q, uCOMMS_FLUSH_MANUAL);
+}
+
+// Writes what the port did not take before, call it once the port polls
+// POLLOUT while ucomms_txq_pending() is not 0. Returns 0, or -1 with errno set.
+int ucomms_txq_resume(uCOMMS_TXQ *q) {
+    CHECK_PTR(q);
+    return txq_write(q);
+}
+
+// Queues one frame, flushing when a limit is hit. flags is uCOMMS_TX_FLAGS.
+// Returns 0, or -1 with errno set: EMSGSIZE above uCOMMS_MAX_FRAME_PAYLOAD,
+// EAGAIN when the frame does not fit behind what the port has not taken yet.
+int ucomms_txq_send(uCOMMS_TXQ *q, const void *payload, size_t len, int flags) {
+    CHECK_PTR(q);
+    if (len) CHECK_PTR(payload);
+    if (len > uCOMMS_MAX_FRAME_PAYLOAD) {
+        errno = EMSGSIZE;
+        return -1;
+    }
+
+    size_t n = encode_frame_crc(q->crc_mode, payload, len, q->buf + q->used, sizeof(q->buf) - q->used);
+    if (!n && q->used) {
+        if (txq_flush(q, uCOMMS_FLUSH_BYTES) < 0) return -1;
+        n = encode_frame_crc(q->crc_mode, payload, len, q->buf + q->used, sizeof(q->buf) - q->used);
+    }
+    if (!n && ucomms_txq_pending(q)) {
+        /// ? The port is backed up, let the caller wait for it instead of us.
+        errno = EAGAIN;
+        return -1;
+    }
+    if (!n) {
+        /// ? Bigger than the whole queue, everything ahead of it already went out.
+        /// ? It is encoded once into big, which only grows, and both the port
+        /// ? and the capture take it from there.
+        if (q->big_cap < uCOMMS_ENCODED_MAX(len)) {
+            uint8_t *big = realloc(q->big, uCOMMS_ENCODED_MAX(len));
+            if (!big) return -1;
+            q->big     = big;
+            q->big_cap = uCOMMS_ENCODED_MAX(len);
+        }
+        size_t bytes = encode_frame_crc(q->crc_mode, payload, len, q->big, q->big_cap);
+        q->frames_per_flush[0]++;
+        q->flushes[uCOMMS_FLUSH_BYTES]++;
+        q->frames_sent++;
+        q->bytes_sent += bytes;
+        if (q->stats) {
+            q->stats->frames_out++;
+            q->stats->bytes_out += bytes;
+        }
+        if (q->capture) ucomms_capture_append(q->capture, q->capture_stream, uCOMMS_CAPTURE_TX, q->big, bytes);
+        q->big_len = bytes;
+        return txq_write(q);
+    }
+
+    if (!q->queued) q->deadline_ns = ucomms_now_ns() + (uint64_t)q->max_delay_us * 1000u;
+    q->used += n;
+    q->queued++;
+
+    if (flags & uCOMMS_TX_URGENT)         return txq_flush(q, uCOMMS_FLUSH_URGENT);
+    if (q->used - q->out >= q->max_bytes) return txq_flush(q, uCOMMS_FLUSH_BYTES);
+    if (q->queued >= q->max_frames)       return txq_flush(q, uCOMMS_FLUSH_FRAMES);
+    if (!q->max_delay_us)                 return txq_flush(q, uCOMMS_FLUSH_DEADLINE);
+    return 0;
+}
+
+// Flushes the queue once its oldest frame has waited max_delay_us.
+// Returns 0, or -1 with errno set.
+int ucomms_txq_poll(uCOMMS_TXQ *q) {
+    CHECK_PTR(q);
+    if (!q->queued || ucomms_now_ns() < q->deadline_ns) return 0;
+    return txq_flush(q, uCOMMS_FLUSH_DEADLINE);
+}
+
+// Returns how long a poll()/epoll_wait() may sleep before ucomms_txq_poll()
+// is due, in ms rounded up, or -1 when nothing is queued.
+int ucomms_txq_timeout_ms(const uCOMMS_TXQ *q) {
+    CHECK_PTR(q);
+    if (!q->queued) return -1;
+    uint64_t now = ucomms_now_ns();
+    if (now >= q->deadline_ns) return 0;
+    return (int)((q->deadline_ns - now + 999999u) / 1000000u);
+}
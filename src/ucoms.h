@@ -1,11 +1,18 @@
+#pragma once
+
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
 #include "checks.h"
+#include "scan.h"
+#include "dispatch.h"
+#include "crc.h"
+#include "stats.h"
 
-#define uCOMMS_CONTEXT_BUFFER_SIZE 64
+#define uCOMMS_CONTEXT_BUFFER_SIZE 64       /// ? Embedded buffer, enough for small targets.
+#define uCOMMS_MAX_BUFFER_SIZE     0xFFFF   /// ? Largest external buffer, see attach_buffer().
 
 typedef enum {
     START_BYTE_FLAG  = 0,
@@ -14,6 +21,7 @@ typedef enum {
     POST_CMD_FLAG    = 3,
     GET_CMD_FLAG     = 4,
     ESC_CMD_FLAG     = 5,
+    RESYNC_FLAG      = 6,    /// ? A frame was dropped, its STOP_BYTE is still to come.
 } COMMUNICATION_FLAGS;
 
 
@@ -23,19 +31,120 @@ typedef enum {
     ESC_BYTE   = 0x10,
 } uCOMMUNICATION_FLAGS;
 
+/// * Byte stuffing: a reserved byte inside a frame (length or payload) is sent
+/// * as ESC_BYTE followed by the byte XOR uCOMMS_ESC_XOR, which is never reserved.
+#define uCOMMS_ESC_XOR 0x20
+
+// Returns 1 if the byte has to be escaped inside a frame.
+#define IS_RESERVED_BYTE(b) ((b) == START_BYTE || (b) == STOP_BYTE || (b) == ESC_BYTE)
+
+
+typedef enum {
+    PARSE_OK                     =  0,   /// ? Byte consumed, nothing to report.
+    PARSE_FRAME                  =  1,   /// ? STOP_BYTE completed a valid frame.
+    PARSE_ERR_NO_START           = -1,   /// ? STOP_BYTE outside of a frame.
+    PARSE_ERR_NO_LENGTH          = -2,   /// ? STOP_BYTE straight after START_BYTE.
+    PARSE_ERR_LENGTH_MISMATCH    = -3,   /// ? Payload length != length byte.
+    PARSE_ERR_OVERFLOW           = -4,   /// ? Frame does not fit in the frame buffer.
+    PARSE_ERR_ESCAPE             = -5,   /// ? ESC_BYTE not followed by a data byte.
+    PARSE_ERR_CRC                = -6,   /// ? Trailer missing or does not match.
+    PARSE_ERR_TRUNCATED          = -7,   /// ? START_BYTE inside a frame. Only counted, the byte
+                                         /// ? itself opens the next frame and returns PARSE_OK.
+} uCOMMS_PARSE_STATUS;
+
 
 typedef struct {
-    char    comms_buf[uCOMMS_CONTEXT_BUFFER_SIZE];    /// ? Buffer that holds the current command.
-    uint8_t comms_flags;                              /// ? Stores the current set comms flags.
-    uint8_t cmd_len;                                  /// ? So validation, i think :).
-    uint8_t curr_cmd_len;    /// ? Holds the current len command, will be  used to validate later.
+    char     comms_buf[uCOMMS_CONTEXT_BUFFER_SIZE];   /// ? Buffer that holds the current command.
+    uint8_t  comms_flags;                             /// ? Stores the current set comms flags.
+    uint16_t cmd_len;                                 /// ? So validation, i think :).
+    uint16_t curr_cmd_len;   /// ? Holds the current len command, will be  used to validate later.
+    uint32_t dropped_frames; /// ? Frames thrown away by a parse error, survives resets.
+    uint32_t unknown_cmds;   /// ? Frames no dispatch handler claimed.
+    const uCOMMS_DISPATCH *dispatch;   /// ? Command table used by interprete_cmd(), optional.
+    uint8_t  crc_mode;       /// ? uCOMMS_CRC_MODE agreed with the other end of the port.
+    uint8_t  crc_got;        /// ? Trailer bytes received so far.
+    uint8_t  crc_buf[4];     /// ? Trailer as received, little endian.
+    uint32_t crc;            /// ? Running CRC over the length byte and payload.
+    uint8_t  len_shift;      /// ? Bits of the varint length received so far.
+    uint16_t ext_cap;        /// ? Size of ext_buf.
+    char    *ext_buf;        /// ? Caller owned frame buffer, comms_buf is used when NULL.
+    uCOMMS_STATS *stats;     /// ? Link statistics, optional.
 } uCOMMS_CONTEXT;
 
 
+/// * Parse errors used to exit() the whole process. By default a bad frame is
+/// * now dropped and the parser hunts for the next START_BYTE, build with
+/// * uCOMMS_FATAL_PARSE_ERRORS to get the old crash-on-error behaviour back.
+#ifdef uCOMMS_FATAL_PARSE_ERRORS
+#define PARSE_CHECK(ctx, condition, status, msg) CHECK(condition, msg)
+#else
+#define PARSE_CHECK(ctx, condition, status, msg)  \
+    do {                                          \
+        if (!(condition)) {                       \
+            drop_frame(ctx, status);              \
+            return (status);                      \
+        }                                         \
+    } while (0)
+#endif
+
+
 // Resets the parsed comms context.
+// Only the frame state is cleared, counters are kept across frames.
 void reset_comms_context(uCOMMS_CONTEXT *ctx) {
     CHECK_PTR(ctx);
-    memset(ctx, 0, sizeof(*ctx));
+    memset(ctx->comms_buf, 0, sizeof(ctx->comms_buf));
+    ctx->comms_flags  = 0;
+    ctx->cmd_len      = 0;
+    ctx->curr_cmd_len = 0;
+    ctx->crc_got      = 0;
+    ctx->len_shift    = 0;
+}
+
+// Returns the buffer frames are parsed into, comms_buf unless one was attached.
+char *frame_buf(uCOMMS_CONTEXT *ctx) {
+    return ctx->ext_buf ? ctx->ext_buf : ctx->comms_buf;
+}
+
+// Returns the size of the frame buffer, payloads can be up to 2 bytes shorter.
+size_t frame_cap(const uCOMMS_CONTEXT *ctx) {
+    return ctx->ext_buf ? ctx->ext_cap : uCOMMS_CONTEXT_BUFFER_SIZE;
+}
+
+// Parses frames into a caller owned buffer instead of comms_buf, so the frame
+// size is a runtime choice. buf must outlive the context, NULL goes back to
+// the embedded buffer. Any frame in progress is dropped.
+void attach_buffer(uCOMMS_CONTEXT *ctx, char *buf, size_t cap) {
+    CHECK_PTR(ctx);
+    CHECK((buf == NULL || (cap >= 2 && cap <= uCOMMS_MAX_BUFFER_SIZE)), "attach_buffer() size");
+    ctx->ext_buf = buf;
+    ctx->ext_cap = buf ? (uint16_t)cap : 0;
+    reset_comms_context(ctx);
+}
+
+// Counts a frame that was thrown away.
+void count_drop(uCOMMS_CONTEXT *ctx, uCOMMS_PARSE_STATUS status) {
+    ctx->dropped_frames++;
+
+    uCOMMS_STATS *st = ctx->stats;
+    if (!st) return;
+    st->resyncs++;
+    switch (status) {
+        case PARSE_ERR_NO_START:          st->no_start++;          break;
+        case PARSE_ERR_NO_LENGTH:         st->no_length++;         break;
+        case PARSE_ERR_LENGTH_MISMATCH:   st->length_mismatches++; break;
+        case PARSE_ERR_OVERFLOW:          st->overflows++;         break;
+        case PARSE_ERR_ESCAPE:            st->bad_escapes++;       break;
+        case PARSE_ERR_CRC:               st->crc_failures++;      break;
+        case PARSE_ERR_TRUNCATED:         st->truncated++;         break;
+        default:                                                   break;
+    }
+}
+
+// Throws away the frame being parsed and goes back to hunting for START_BYTE.
+void drop_frame(uCOMMS_CONTEXT *ctx, uCOMMS_PARSE_STATUS status) {
+    reset_comms_context(ctx);
+    ctx->comms_flags |= 1 << RESYNC_FLAG;
+    count_drop(ctx, status);
 }
 
 // Compare two uCOMMS_CONTEXT instances
@@ -55,37 +164,88 @@ int compare_contexts(const uCOMMS_CONTEXT *ctx1, const uCOMMS_CONTEXT *ctx2) {
 }
 
 
+// Hands a completed frame to the context's dispatch table, if it has one.
 void interprete_cmd(uCOMMS_CONTEXT *ctx) {
     CHECK_PTR(ctx);
-    return;
+    if (!ctx->dispatch) return;
+    if (!dispatch_cmd(ctx->dispatch, frame_buf(ctx), ctx->curr_cmd_len)) ctx->unknown_cmds++;
 }
 
-/// * {START_BYTE, MSG_LEN, COMMAND, STOP_BYTE}
-void parse_cmd(uCOMMS_CONTEXT *ctx, char data) {
-    CHECK_PTR(ctx);          /// ? Passed a valid comms context.
+// Returns 1 once a full frame has been parsed into frame_buf().
+int frame_ready(const uCOMMS_CONTEXT *ctx) {
+    return (ctx->comms_flags & (1 << STOP_BYTE_FLAG)) != 0;
+}
+
+// Returns 1 if the frame trailer matches the CRC of what was parsed.
+int crc_matches(const uCOMMS_CONTEXT *ctx) {
+    size_t   size = crc_size(ctx->crc_mode);
+    uint32_t want = crc_final(ctx->crc_mode, ctx->crc);
+    if (ctx->crc_got != size) return 0;
+    for (size_t i = 0; i < size; i++) {
+        if (ctx->crc_buf[i] != (uint8_t)(want >> (8 * i))) return 0;
+    }
+    return 1;
+}
 
-    /// ? Now the actual parsing begins.
+// Returns 1 between START_BYTE and STOP_BYTE.
+int frame_open(const uCOMMS_CONTEXT *ctx) {
+    return (ctx->comms_flags & ((1 << START_BYTE_FLAG) | (1 << STOP_BYTE_FLAG))) == (1 << START_BYTE_FLAG);
+}
+
+// Validates a frame on its STOP_BYTE, drops it if anything is off.
+uCOMMS_PARSE_STATUS check_stop(uCOMMS_CONTEXT *ctx) {
+    // Check if we're in valid state for STOP
+    PARSE_CHECK(ctx, frame_open(ctx), PARSE_ERR_NO_START, "STOP without START");
+    PARSE_CHECK(ctx, !(ctx->comms_flags & (1 << ESC_CMD_FLAG)), PARSE_ERR_ESCAPE, "STOP after ESC");
+    PARSE_CHECK(ctx, (ctx->comms_flags & (1 << LENGTH_BYTE_FLAG)), PARSE_ERR_NO_LENGTH, "STOP without length");
+    // Check length matches
+    PARSE_CHECK(ctx, (ctx->curr_cmd_len == ctx->cmd_len), PARSE_ERR_LENGTH_MISMATCH, "Length mismatch");
+    // Check buffer bounds before adding null terminator
+    PARSE_CHECK(ctx, (ctx->curr_cmd_len < frame_cap(ctx) - 1), PARSE_ERR_OVERFLOW, "Buffer overflow");
+    // Check the trailer when the port uses one
+    PARSE_CHECK(ctx, (!ctx->crc_mode || crc_matches(ctx)), PARSE_ERR_CRC, "CRC mismatch");
+    return PARSE_OK;
+}
+
+/// * parse_cmd() without the pointer check, the bulk path checks once per chunk.
+uCOMMS_PARSE_STATUS parse_byte(uCOMMS_CONTEXT *ctx, char data) {
     switch (data) {
         /// * START BYTE => start of a new message.
         case START_BYTE: {
+            /// ? A frame still open here was cut short, it is lost like any bad frame.
+            if (frame_open(ctx)) count_drop(ctx, PARSE_ERR_TRUNCATED);
             reset_comms_context(ctx);
             ctx->comms_flags  |= 1 << START_BYTE_FLAG;
-            break;
+            return PARSE_OK;
         }
 
         /// * STOP BYTE => end of a transmission.
         case STOP_BYTE: {
-            // Check if we're in valid state for STOP
-            CHECK((ctx->comms_flags & (1 << START_BYTE_FLAG)), "STOP without START");
-            CHECK((ctx->comms_flags & (1 << LENGTH_BYTE_FLAG)), "STOP without length");
-            // Check length matches
-            CHECK((ctx->curr_cmd_len == ctx->cmd_len), "Length mismatch");
-            // Check buffer bounds before adding null terminator
-            CHECK((ctx->curr_cmd_len < uCOMMS_CONTEXT_BUFFER_SIZE - 1), "Buffer overflow");
+            /// ? Tail of a frame that was already dropped, not a new error.
+            if (ctx->comms_flags & (1 << RESYNC_FLAG)) {
+                ctx->comms_flags &= ~(1 << RESYNC_FLAG);
+                return PARSE_OK;
+            }
+            uCOMMS_PARSE_STATUS status = check_stop(ctx);
+            if (status != PARSE_OK) {
+                /// ? This STOP_BYTE ended the bad frame, nothing left to skip.
+                ctx->comms_flags &= ~(1 << RESYNC_FLAG);
+                return status;
+            }
             ctx->comms_flags |= 1 << STOP_BYTE_FLAG;
-            ctx->comms_buf[ctx->curr_cmd_len] = '\0';
+            if (ctx->stats) ctx->stats->frames_in++;
+            frame_buf(ctx)[ctx->curr_cmd_len] = '\0';
             interprete_cmd(ctx);
-            break;
+            return PARSE_FRAME;
+        }
+
+        /// * ESC BYTE => the next byte is data, XORed with uCOMMS_ESC_XOR.
+        case ESC_BYTE: {
+            if (!frame_open(ctx)) return PARSE_OK;
+            PARSE_CHECK(ctx, !(ctx->comms_flags & (1 << ESC_CMD_FLAG)), PARSE_ERR_ESCAPE, "ESC after ESC");
+            ctx->comms_flags |= 1 << ESC_CMD_FLAG;
+            if (ctx->stats) ctx->stats->escapes++;
+            return PARSE_OK;
         }
 
         /// * DATA BYTE => msg payload
@@ -93,24 +253,121 @@ void parse_cmd(uCOMMS_CONTEXT *ctx, char data) {
         /// * we need to also detect that, we can achieve that goal with the
         /// * LENGTH BYTE FLAG.
         default : {
+            /// ? Noise between frames.
+            if (!frame_open(ctx)) return PARSE_OK;
+
+            /// ? Second half of an escape sequence.
+            if (ctx->comms_flags & (1 << ESC_CMD_FLAG)) {
+                data ^= uCOMMS_ESC_XOR;
+                ctx->comms_flags &= ~(1 << ESC_CMD_FLAG);
+            }
+
             /// ? Current data byte is PAYLOAD length 
-            if ((ctx->comms_flags & (1 << START_BYTE_FLAG)) 
-                && !(ctx->comms_flags & (1 << LENGTH_BYTE_FLAG))) {
-                    ctx->cmd_len = data;
+            /// ? The length is a varint, 7 bits per byte, low bits first, the top
+            /// ? bit set on every byte but the last. Lengths below 128 are the
+            /// ? single byte they always were.
+            if (!(ctx->comms_flags & (1 << LENGTH_BYTE_FLAG))) {
+                    uint8_t  b = (uint8_t)data;
+                    uint32_t len = ctx->cmd_len | ((uint32_t)(b & 0x7F) << ctx->len_shift);
+                    if (ctx->crc_mode) {
+                        if (ctx->len_shift == 0) ctx->crc = crc_begin(ctx->crc_mode);
+                        ctx->crc = crc_update(ctx->crc_mode, ctx->crc, &b, 1);
+                    }
+                    /// ? A frame that can never fit is dropped right away.
+                    PARSE_CHECK(ctx, (len < frame_cap(ctx) - 1), PARSE_ERR_OVERFLOW, "Buffer overflow");
+                    ctx->cmd_len = (uint16_t)len;
+                    if (b & 0x80) {
+                        PARSE_CHECK(ctx, (ctx->len_shift < 14), PARSE_ERR_OVERFLOW, "Length too long");
+                        ctx->len_shift += 7;
+                        return PARSE_OK;
+                    }
                     ctx->comms_flags |= 1 << LENGTH_BYTE_FLAG;
-                    return;
+                    return PARSE_OK;
             }
 
-            /// ? Current data byte is part of the actual msg
-            if ((ctx->comms_flags & (1 << START_BYTE_FLAG)) 
-                && (ctx->comms_flags & (1<< LENGTH_BYTE_FLAG))) {
-                    /// ? bounds checking
-                    CHECK((ctx->curr_cmd_len < uCOMMS_CONTEXT_BUFFER_SIZE - 1), "ctx buffer overflow");
-                    ctx->comms_buf[ctx->curr_cmd_len++] = data;
-                    return;
+            /// ? Payload is complete, the rest up to STOP_BYTE is the CRC trailer.
+            if (ctx->crc_mode && ctx->curr_cmd_len == ctx->cmd_len) {
+                PARSE_CHECK(ctx, (ctx->crc_got < crc_size(ctx->crc_mode)), PARSE_ERR_LENGTH_MISMATCH, "Trailer too long");
+                ctx->crc_buf[ctx->crc_got++] = (uint8_t)data;
+                return PARSE_OK;
             }
 
-            break;
+            /// ? Current data byte is part of the actual msg
+            /// ? bounds checking
+            PARSE_CHECK(ctx, (ctx->curr_cmd_len < frame_cap(ctx) - 1), PARSE_ERR_OVERFLOW, "ctx buffer overflow");
+            frame_buf(ctx)[ctx->curr_cmd_len++] = data;
+            if (ctx->crc_mode) ctx->crc = crc_update(ctx->crc_mode, ctx->crc, (const uint8_t *)&data, 1);
+            return PARSE_OK;
         }
     }
+}
+
+/// * {START_BYTE, MSG_LEN, COMMAND, STOP_BYTE}
+/// * MSG_LEN is a 1 to 3 byte varint, a single byte below 128.
+/// * Reserved bytes in MSG_LEN or COMMAND are escaped, see uCOMMS_ESC_XOR.
+/// * With crc_mode set the frame is {START_BYTE, MSG_LEN, COMMAND, CRC, STOP_BYTE},
+/// * the CRC covers MSG_LEN and COMMAND and is escaped like them.
+uCOMMS_PARSE_STATUS parse_cmd(uCOMMS_CONTEXT *ctx, char data) {
+    CHECK_PTR(ctx);          /// ? Passed a valid comms context.
+    if (ctx->stats) ctx->stats->bytes_in++;
+    return parse_byte(ctx, data);
+}
+
+/// * Consumes what parse_byte() does not need to see, at most len bytes.
+/// * Inside the payload that is the run up to the next reserved byte, copied in
+/// * one go. An ESC and the byte after it always go through parse_byte(). The
+/// * last slot stays free for the terminator, an overflowing byte goes the slow
+/// * way so it hits the same bounds check as parse_cmd(). With a CRC the run
+/// * also stops at the end of the payload so the trailer goes the slow way, and
+/// * the CRC is updated per run. Between frames only the reserved bytes mean
+/// * anything. Returns the bytes consumed, 0 when the next byte needs parse_byte().
+size_t parse_run(uCOMMS_CONTEXT *ctx, const uint8_t *data, size_t len) {
+    if (!frame_open(ctx)) return ucomms_find_special(data, len);
+    if ((ctx->comms_flags & ((1 << LENGTH_BYTE_FLAG) | (1 << ESC_CMD_FLAG))) != (1 << LENGTH_BYTE_FLAG)) return 0;
+
+    size_t run  = ucomms_find_special(data, len);
+    size_t room = (frame_cap(ctx) - 1) - ctx->curr_cmd_len;
+    if (ctx->crc_mode) {
+        size_t left = ctx->curr_cmd_len < ctx->cmd_len ? (size_t)(ctx->cmd_len - ctx->curr_cmd_len) : 0;
+        if (left < room) room = left;
+    }
+    size_t   n   = run < room ? run : room;
+    uint8_t *dst = (uint8_t *)frame_buf(ctx) + ctx->curr_cmd_len;
+    /// ? The receive ring decodes in place, dst is then data (nothing to do)
+    /// ? or behind it by the escapes seen so far.
+    if (dst != data) memmove(dst, data, n);
+    if (ctx->crc_mode) ctx->crc = crc_update(ctx->crc_mode, ctx->crc, dst, n);
+    ctx->curr_cmd_len += (uint16_t)n;
+    return n;
+}
+
+/// * Bulk version of parse_cmd(), produces exactly the same frames.
+/// * Only the reserved bytes and the length byte go through parse_byte(), payload
+/// * runs are found with ucomms_find_special() and copied in one go, see
+/// * parse_run().
+/// * Stops right after a completed frame so the caller can consume frame_buf()
+/// * before the next START_BYTE resets it, returns the number of bytes consumed.
+/// * Bad frames are dropped (see dropped_frames) and parsing carries on with the
+/// * next START_BYTE in the same chunk.
+/// *
+/// *     while (len) {
+/// *         size_t n = parse_buf(&ctx, data, len);
+/// *         data += n; len -= n;
+/// *         if (frame_ready(&ctx)) handle(frame_buf(&ctx), ctx.curr_cmd_len);
+/// *     }
+size_t parse_buf(uCOMMS_CONTEXT *ctx, const uint8_t *data, size_t len) {
+    CHECK_PTR(ctx);
+    CHECK_PTR(data);
+
+    /// ? The previous call handed out a frame, start hunting for the next one.
+    if (frame_ready(ctx)) reset_comms_context(ctx);
+
+    size_t i = 0;
+    while (i < len) {
+        i += parse_run(ctx, data + i, len - i);
+        if (i == len) break;
+        if (parse_byte(ctx, (char)data[i++]) == PARSE_FRAME) break;
+    }
+    if (ctx->stats) ctx->stats->bytes_in += i;
+    return i;
 }
\ No newline at end of file
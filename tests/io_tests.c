@@ -0,0 +1,1048 @@
+#define _GNU_SOURCE     // for F_SETPIPE_SZ
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <pty.h>        // openpty()
+
+// Include your header files
+#include "checks.h"
+#include "ucoms.h"
+#include "frame.h"
+#include "tx.h"
+#include "port.h"
+#include "engine.h"
+#include "reader.h"
+#include "session.h"
+#include "txq.h"
+#include "capture.h"
+#include "mux.h"
+#include "rxring.h"
+#include "test_harness.h"
+
+
+/// ? Reads until EOF and counts the frames matching the expected payload.
+static int count_frames(int fd, const uint8_t *payload, size_t len) {
+    uCOMMS_CONTEXT ctx = {0};
+    uint8_t buf[512];
+    int frames = 0;
+    ssize_t n;
+    while ((n = read(fd, buf, sizeof(buf))) > 0) {
+        const uint8_t *p = buf;
+        size_t left = (size_t)n;
+        while (left) {
+            size_t used = parse_buf(&ctx, p, left);
+            p += used;
+            left -= used;
+            if (frame_ready(&ctx) && ctx.curr_cmd_len == len && memcmp(ctx.comms_buf, payload, len) == 0) {
+                frames++;
+            }
+        }
+    }
+    return frames;
+}
+
+
+/// ? Test implementations
+
+int test_send_matches_encoder(void) {
+    int fds[2];
+    CHECK(pipe(fds) == 0, "pipe()");
+
+    const uint8_t dirty[] = {'A', START_BYTE, 'B', ESC_BYTE, STOP_BYTE};
+    uint8_t expected[64], got[64];
+    size_t n = encode_frame((const uint8_t *)"TOGGLE", 6, expected, sizeof(expected));
+    n += encode_frame(dirty, sizeof(dirty), expected + n, sizeof(expected) - n);
+
+    TEST_ASSERT(ucomms_send(fds[1], "TOGGLE", 6) == 0, "ucomms_send() of a clean payload");
+    TEST_ASSERT(ucomms_send(fds[1], dirty, sizeof(dirty)) == 0, "ucomms_send() of a dirty payload");
+    TEST_ASSERT(read(fds[0], got, sizeof(got)) == (ssize_t)n, "wire size should match encode_frame()");
+    TEST_ASSERT(memcmp(got, expected, n) == 0, "wire bytes should match encode_frame()");
+
+    n = encode_frame_crc(uCOMMS_CRC32C, dirty, sizeof(dirty), expected, sizeof(expected));
+    TEST_ASSERT(ucomms_send_crc(fds[1], uCOMMS_CRC32C, dirty, sizeof(dirty)) == 0, "ucomms_send_crc()");
+    TEST_ASSERT(read(fds[0], got, sizeof(got)) == (ssize_t)n, "CRC frame size should match encode_frame_crc()");
+    TEST_ASSERT(memcmp(got, expected, n) == 0, "CRC frame should match encode_frame_crc()");
+
+    static uint8_t big[uCOMMS_MAX_FRAME_PAYLOAD + 1];
+    TEST_ASSERT(ucomms_send(fds[1], big, sizeof(big)) == -1 && errno == EMSGSIZE, "oversized payload is refused");
+
+    close(fds[0]);
+    close(fds[1]);
+    printf("    - Test writev() encoder against encode_frame()\n");
+    return 1;
+}
+
+int test_send_batch_partial_writes(void) {
+    enum { FRAMES = 600 };
+    int fds[2];
+    CHECK(pipe(fds) == 0, "pipe()");
+
+    /// ? Small non-blocking pipe, the batch is ~40 KiB so writev() hits
+    /// ? EAGAIN and partial writes while the child drains it.
+    fcntl(fds[1], F_SETPIPE_SZ, 4096);
+    fcntl(fds[1], F_SETFL, fcntl(fds[1], F_GETFL) | O_NONBLOCK);
+
+    uint8_t payload[uCOMMS_MAX_PAYLOAD];
+    for (size_t i = 0; i < sizeof(payload); i++) payload[i] = (uint8_t)i;   /// ? has escapes too
+
+    pid_t pid = fork();
+    CHECK(pid >= 0, "fork()");
+    if (pid == 0) {
+        close(fds[1]);
+        usleep(20000);
+        exit(count_frames(fds[0], payload, sizeof(payload)) == FRAMES ? 0 : 1);
+    }
+    close(fds[0]);
+
+    static struct iovec frames[FRAMES];
+    for (int i = 0; i < FRAMES; i++) {
+        frames[i].iov_base = payload;
+        frames[i].iov_len  = sizeof(payload);
+    }
+    int rc = ucomms_send_batch(fds[1], frames, FRAMES);
+    close(fds[1]);
+
+    int status;
+    waitpid(pid, &status, 0);
+    TEST_ASSERT(rc == 0, "ucomms_send_batch() should succeed on a slow reader");
+    TEST_ASSERT(WIFEXITED(status) && WEXITSTATUS(status) == 0, "reader should decode every frame intact");
+    printf("    - Test batch send through EAGAIN and partial writes\n");
+    return 1;
+}
+
+/// ? Frames seen per port, the payload names the port it was sent on.
+typedef struct {
+    int index;
+    int frames;
+    int wrong;
+} PORT_TALLY;
+
+static void tally_frame(uCOMMS_PORT *port, const uint8_t *payload, size_t len) {
+    PORT_TALLY *tally = port->user;
+    char expected[16];
+    int n = snprintf(expected, sizeof(expected), "PORT%02d", tally->index);
+    if (len != (size_t)n || memcmp(payload, expected, len) != 0) tally->wrong++;
+    tally->frames++;
+}
+
+int test_engine_many_ptys(void) {
+    enum { PORTS = 16, FRAMES = 50 };
+    int master[PORTS];
+    PORT_TALLY tally[PORTS] = {0};
+    uCOMMS_ENGINE eng;
+    TEST_ASSERT(ucomms_engine_init(&eng) == 0, "engine should initialise");
+
+    /// ? The pty slave stands in for the device node, the master for the device.
+    for (int i = 0; i < PORTS; i++) {
+        int slave;
+        CHECK(openpty(&master[i], &slave, NULL, NULL, NULL) == 0, "openpty()");
+        int fd = ucomms_port_open(ttyname(slave));
+        close(slave);
+        TEST_ASSERT(fd >= 0, "pty slave should open as a port");
+        tally[i].index = i;
+        TEST_ASSERT(ucomms_engine_add_port(&eng, fd, tally_frame, &tally[i]) != NULL, "port should register");
+    }
+
+    /// ? Interleave the devices, a frame at a time.
+    for (int k = 0; k < FRAMES; k++) {
+        for (int i = 0; i < PORTS; i++) {
+            char name[16];
+            int n = snprintf(name, sizeof(name), "PORT%02d", i);
+            CHECK(ucomms_send(master[i], name, (size_t)n) == 0, "ucomms_send()");
+        }
+    }
+
+    int total = 0;
+    for (int spins = 0; total < PORTS * FRAMES && spins < 1000; spins++) {
+        int got = ucomms_engine_poll(&eng, 100);
+        TEST_ASSERT(got >= 0, "engine poll should not fail");
+        total += got;
+    }
+    TEST_ASSERT(total == PORTS * FRAMES, "every frame on every port should be dispatched");
+    for (int i = 0; i < PORTS; i++) {
+        if (tally[i].frames != FRAMES || tally[i].wrong) {
+            fprintf(stderr, "FAIL: port %d got %d frames, %d misrouted\n", i, tally[i].frames, tally[i].wrong);
+            return 0;
+        }
+    }
+    uint64_t counted = 0;
+    for (int i = 0; i < uCOMMS_MAX_PORTS; i++) {
+        if (eng.ports[i].fd >= 0) counted += eng.ports[i].stats.frames_in;
+    }
+    TEST_ASSERT(counted == PORTS * FRAMES, "port stats should count every frame");
+
+    /// ? A device going away should take its port out of the engine.
+    close(master[0]);
+    for (int spins = 0; eng.count == PORTS && spins < 10; spins++) ucomms_engine_poll(&eng, 100);
+    TEST_ASSERT(eng.count == PORTS - 1, "hung up port should be removed");
+
+    for (int i = 0; i < uCOMMS_MAX_PORTS; i++) {
+        if (eng.ports[i].fd >= 0) close(eng.ports[i].fd);
+    }
+    for (int i = 1; i < PORTS; i++) close(master[i]);
+    ucomms_engine_close(&eng);
+    printf("    - Test epoll engine over %d pty pairs\n", PORTS);
+    return 1;
+}
+
+/// ? Device side of the reader test, runs on its own thread.
+typedef struct {
+    int fd;
+    int frames;
+} PTY_WRITER;
+
+static int write_numbered_frames(void *arg) {
+    PTY_WRITER *w = arg;
+    for (int k = 0; k < w->frames; k++) {
+        char msg[16];
+        int n = snprintf(msg, sizeof(msg), "F%05d", k);
+        CHECK(ucomms_send(w->fd, msg, (size_t)n) == 0, "ucomms_send()");
+    }
+    return 0;
+}
+
+int test_reader_thread_ring(void) {
+    enum { FRAMES = 5000 };
+    static uCOMMS_READER rd;
+    int master, slave;
+    CHECK(openpty(&master, &slave, NULL, NULL, NULL) == 0, "openpty()");
+    int fd = ucomms_port_open(ttyname(slave));
+    close(slave);
+    TEST_ASSERT(fd >= 0, "pty slave should open as a port");
+    TEST_ASSERT(ucomms_reader_start(&rd, fd) == 0, "reader thread should start");
+
+    PTY_WRITER w = {.fd = master, .frames = FRAMES};
+    thrd_t writer;
+    CHECK(thrd_create(&writer, write_numbered_frames, &w) == thrd_success, "thrd_create()");
+
+    /// ? Frames must come out in order, any gap has to be an overrun.
+    int next = 0, received = 0, out_of_order = 0;
+    while (next < FRAMES) {
+        const uCOMMS_FRAME_SLOT *slot = ring_peek(&rd.ring);
+        if (!slot) {
+            if (received + (int)atomic_load(&rd.ring.overruns) >= FRAMES) break;
+            thrd_yield();
+            continue;
+        }
+        int k = atoi((const char *)slot->payload + 1);
+        if (slot->len != 6 || k < next) out_of_order++;
+        next = k + 1;
+        received++;
+        ring_pop(&rd.ring);
+    }
+
+    thrd_join(writer, NULL);
+    ucomms_reader_stop(&rd);
+    uint32_t overruns = atomic_load(&rd.ring.overruns);
+    printf("[RECEIVED]: %d : [OVERRUNS]: %u\n", received, overruns);
+    TEST_ASSERT(out_of_order == 0, "frames should come out of the ring in order");
+    TEST_ASSERT(received + (int)overruns == FRAMES, "every frame should be delivered or counted as an overrun");
+    TEST_ASSERT(ucomms_reader_pop(&rd, (uint8_t[uCOMMS_RING_SLOT_SIZE]){0}) == -1, "ring should be empty");
+
+    close(fd);
+    close(master);
+    printf("    - Test reader thread and SPSC frame ring\n");
+    return 1;
+}
+
+/// ? Device side of the session test. Holds the first 4 requests and answers
+/// ? them newest first, after that answers straight away. Ignores the first
+/// ? copy of "DROP" and every "MUTE".
+static void session_device(int fd) {
+    uCOMMS_CONTEXT ctx = {0};
+    uint8_t held[4][uCOMMS_MAX_PAYLOAD], chunk[256];
+    size_t  held_len[4];
+    int nheld = 0, dropped = 0;
+    ssize_t n;
+    while ((n = read(fd, chunk, sizeof(chunk))) > 0) {
+        for (size_t off = 0; off < (size_t)n;) {
+            off += parse_buf(&ctx, chunk + off, (size_t)n - off);
+            if (!frame_ready(&ctx)) continue;
+            const char *cmd = ctx.comms_buf + 1;
+            if (strcmp(cmd, "MUTE") == 0) continue;
+            if (strcmp(cmd, "DROP") == 0 && !dropped++) continue;
+            if (nheld < 0) {    /// ? Held requests already answered.
+                CHECK(ucomms_send(fd, ctx.comms_buf, ctx.curr_cmd_len) == 0, "ucomms_send()");
+                continue;
+            }
+            memcpy(held[nheld], ctx.comms_buf, ctx.curr_cmd_len);
+            held_len[nheld++] = ctx.curr_cmd_len;
+            if (nheld == 4) {
+                while (nheld--) CHECK(ucomms_send(fd, held[nheld], held_len[nheld]) == 0, "ucomms_send()");
+            }
+        }
+    }
+    _exit(0);
+}
+
+typedef struct {
+    char order[8][8];
+    int  status[8];
+    int  done;
+} SESSION_LOG;
+
+static void log_reply(void *user, int status, const uint8_t *reply, size_t len) {
+    SESSION_LOG *log = user;
+    snprintf(log->order[log->done], sizeof(log->order[0]), "%.*s", (int)len, (const char *)reply);
+    log->status[log->done++] = status;
+}
+
+/// ? Writes junk until the pty takes nothing more, not even a byte, for a
+/// ? while. It frees room on its own as it moves bytes to the master side.
+static void fill_pty(int fd) {
+    uint8_t junk[1024];
+    memset(junk, 0x55, sizeof(junk));
+    for (int full = 0; full < 5;) {
+        int took = 0;
+        while (write(fd, junk, sizeof(junk)) > 0) took = 1;
+        while (write(fd, junk, 1) > 0) took = 1;
+        full = took ? 0 : full + 1;
+        usleep(1000);
+    }
+}
+
+/// ? Engine handler for a session, user is the session.
+static void session_frame(uCOMMS_PORT *port, const uint8_t *payload, size_t len) {
+    ucomms_session_on_frame(port->user, payload, len);
+}
+
+int test_session_pipelining(void) {
+    int master, slave;
+    CHECK(openpty(&master, &slave, NULL, NULL, NULL) == 0, "openpty()");
+    int fd = ucomms_port_open(ttyname(slave));
+    close(slave);
+    TEST_ASSERT(fd >= 0, "pty slave should open as a port");
+
+    pid_t pid = fork();
+    CHECK(pid >= 0, "fork()");
+    if (pid == 0) {
+        close(fd);
+        session_device(master);
+    }
+
+    uCOMMS_SESSION s;
+    SESSION_LOG log = {0};
+    TEST_ASSERT(ucomms_session_init(&s, fd, 6, 50, 2) == 0, "session should start");
+    const char *reqs[] = {"A", "B", "C", "D", "DROP", "MUTE"};
+    for (int i = 0; i < 6; i++) {
+        TEST_ASSERT(ucomms_session_request(&s, reqs[i], strlen(reqs[i]), log_reply, &log) == i, "request should get the next sequence number");
+    }
+    TEST_ASSERT(ucomms_session_request(&s, "X", 1, log_reply, &log) == -1 && errno == EAGAIN, "full window should refuse a request");
+    TEST_ASSERT(ucomms_session_in_flight(&s) == 6, "all requests should be in flight");
+
+    uCOMMS_CONTEXT ctx = {0};
+    uint8_t chunk[256];
+    for (int spins = 0; log.done < 6 && spins < 100; spins++) {
+        struct pollfd pfd[2] = {{.fd = fd, .events = POLLIN}, {.fd = ucomms_session_timer_fd(&s), .events = POLLIN}};
+        CHECK(poll(pfd, 2, 1000) >= 0, "poll()");
+        if (pfd[1].revents & POLLIN) CHECK(ucomms_session_on_timer(&s) >= 0, "ucomms_session_on_timer()");
+        if (!(pfd[0].revents & POLLIN)) continue;
+        ssize_t n = read(fd, chunk, sizeof(chunk));
+        for (size_t off = 0; n > 0 && off < (size_t)n;) {
+            off += parse_buf(&ctx, chunk + off, (size_t)n - off);
+            if (frame_ready(&ctx)) ucomms_session_on_frame(&s, (const uint8_t *)ctx.comms_buf, ctx.curr_cmd_len);
+        }
+    }
+
+    /// ? Out of order, DROP after its retransmit, MUTE after 2 retries.
+    const char *expect[] = {"D", "C", "B", "A", "DROP", ""};
+    TEST_ASSERT(log.done == 6, "every request should complete");
+    for (int i = 0; i < 6; i++) {
+        TEST_ASSERT(strcmp(log.order[i], expect[i]) == 0, "replies should complete in the order they arrive");
+        TEST_ASSERT(log.status[i] == (i == 5 ? ETIMEDOUT : 0), "only MUTE should time out");
+    }
+    TEST_ASSERT(s.timeouts == 1, "one request should run out of retries");
+    TEST_ASSERT(s.retransmits >= 3, "DROP once and MUTE twice should be retransmitted");
+    TEST_ASSERT(ucomms_session_in_flight(&s) == 0 && s.base == s.next_seq, "window should be empty");
+    uint32_t stale = s.stale_replies;
+    TEST_ASSERT(ucomms_session_on_frame(&s, (const uint8_t[]){0, 'A'}, 2) == 0 && s.stale_replies == stale + 1, "late reply should be stale");
+
+    ucomms_session_close(&s);
+    close(fd);
+    waitpid(pid, NULL, 0);
+    close(master);
+
+    /// ? bytes_out has to match the wire, escaped CRC trailers included.
+    int fds[2];
+    CHECK(pipe(fds) == 0, "pipe()");
+    uCOMMS_STATS stats = {0};
+    TEST_ASSERT(ucomms_session_init(&s, fds[1], uCOMMS_MAX_WINDOW, 50, 0) == 0, "session should start");
+    s.crc_mode = uCOMMS_CRC16;
+    s.stats    = &stats;
+    size_t escaped = 0;
+    for (int i = 0; i < uCOMMS_MAX_WINDOW; i++) {
+        /// ? Every other request gets a payload whose trailer needs escaping.
+        uint8_t frame[3] = {(uint8_t)i, 0x10, 0}, trailer[8];
+        for (int b = 0; b < 256 && (i & 1); b++) {
+            frame[2] = (uint8_t)b;
+            if (encode_crc_trailer(uCOMMS_CRC16, frame, sizeof(frame), trailer) > 2) break;
+        }
+        escaped += encode_crc_trailer(uCOMMS_CRC16, frame, sizeof(frame), trailer) > 2;
+        TEST_ASSERT(ucomms_session_request(&s, frame + 1, 2, log_reply, &log) == i, "request should be sent");
+    }
+    TEST_ASSERT(escaped >= uCOMMS_MAX_WINDOW / 2, "half the trailers should be escaped");
+    size_t wire = 0;
+    CHECK(fcntl(fds[0], F_SETFL, O_NONBLOCK) == 0, "fcntl()");
+    for (ssize_t n; (n = read(fds[0], chunk, sizeof(chunk))) > 0;) wire += (size_t)n;
+    TEST_ASSERT(stats.frames_out == uCOMMS_MAX_WINDOW && stats.bytes_out == wire, "bytes_out should count escaped trailers");
+    ucomms_session_close(&s);
+    close(fds[0]);
+    close(fds[1]);
+
+    /// ? On an engine port requests and retransmits queue behind a full pty
+    /// ? instead of waiting for it.
+    CHECK(openpty(&master, &slave, NULL, NULL, NULL) == 0, "openpty()");
+    fd = ucomms_port_open(ttyname(slave));
+    close(slave);
+    TEST_ASSERT(fd >= 0, "pty slave should open as a port");
+    CHECK(fcntl(master, F_SETFL, O_NONBLOCK) == 0, "fcntl()");
+    uCOMMS_ENGINE eng;
+    CHECK(ucomms_engine_init(&eng) == 0, "ucomms_engine_init()");
+    uCOMMS_PORT *port = ucomms_engine_add_port(&eng, fd, session_frame, &s);
+    TEST_ASSERT(ucomms_session_init(&s, fd, 4, 1, 1) == 0, "session should start");
+    ucomms_session_queue(&s, &port->txq);
+
+    fill_pty(fd);
+    memset(&log, 0, sizeof(log));
+    TEST_ASSERT(ucomms_session_request(&s, "PING", 4, log_reply, &log) == 0, "request should queue on a full port");
+    usleep(2000);
+    TEST_ASSERT(ucomms_session_on_timer(&s) == 1, "retransmit should queue too");
+    TEST_ASSERT(ucomms_txq_pending(&port->txq) > 0 && port->txq.frames_sent == 2, "both attempts should wait in the port's queue");
+
+    /// ? The device answers every copy, the second reply is stale.
+    uCOMMS_CONTEXT dev = {0};
+    for (int spins = 0; log.done < 1 && spins < 5000; spins++) {
+        ucomms_engine_poll(&eng, 1);
+        ssize_t n = read(master, chunk, sizeof(chunk));
+        for (size_t off = 0; n > 0 && off < (size_t)n;) {
+            off += parse_buf(&dev, chunk + off, (size_t)n - off);
+            if (frame_ready(&dev)) CHECK(ucomms_send(master, dev.comms_buf, dev.curr_cmd_len) == 0, "ucomms_send()");
+        }
+    }
+    TEST_ASSERT(log.done == 1 && log.status[0] == 0 && strcmp(log.order[0], "PING") == 0, "request should complete once the port drains");
+    TEST_ASSERT(dev.dropped_frames == 0, "requests should reach the device whole");
+    ucomms_session_close(&s);
+    ucomms_engine_remove_port(&eng, port);
+    ucomms_engine_close(&eng);
+    close(fd);
+    close(master);
+    printf("    - Test pipelined requests with sequence numbers\n");
+    return 1;
+}
+
+int test_txq_coalescing(void) {
+    int fds[2];
+    CHECK(pipe(fds) == 0, "pipe()");
+    CHECK(fcntl(fds[0], F_SETFL, O_NONBLOCK) == 0, "fcntl()");
+    uint8_t got[4096];
+
+    uCOMMS_TXQ q;
+    ucomms_txq_init(&q, fds[1], uCOMMS_CRC_NONE);
+    q.max_frames   = 4;
+    q.max_delay_us = 2000;
+
+    /// ? 10 frames: two full batches, 2 left waiting for the deadline.
+    for (int i = 0; i < 10; i++) TEST_ASSERT(ucomms_txq_send(&q, "TOGGLE", 6, 0) == 0, "ucomms_txq_send()");
+    TEST_ASSERT(q.flushes[uCOMMS_FLUSH_FRAMES] == 2 && q.queued == 2, "frame limit should flush every 4 frames");
+    TEST_ASSERT(read(fds[0], got, sizeof(got)) == 8 * 9, "only flushed frames should be on the wire");
+    TEST_ASSERT(ucomms_txq_timeout_ms(&q) >= 0 && ucomms_txq_timeout_ms(&q) <= 2, "deadline should be pending");
+    TEST_ASSERT(ucomms_txq_poll(&q) == 0 && q.queued == 2, "poll before the deadline should not flush");
+    usleep(3000);
+    TEST_ASSERT(ucomms_txq_poll(&q) == 0 && q.queued == 0, "poll after the deadline should flush");
+    TEST_ASSERT(q.flushes[uCOMMS_FLUSH_DEADLINE] == 1 && ucomms_txq_timeout_ms(&q) == -1, "deadline flush should be counted");
+
+    /// ? An urgent frame takes the queued one out with it, in order.
+    TEST_ASSERT(ucomms_txq_send(&q, "A", 1, 0) == 0 && ucomms_txq_send(&q, "B", 1, uCOMMS_TX_URGENT) == 0, "urgent send");
+    TEST_ASSERT(q.flushes[uCOMMS_FLUSH_URGENT] == 1 && q.queued == 0, "urgent frame should flush");
+    ssize_t n = read(fds[0], got, sizeof(got));
+    TEST_ASSERT(n == 18 + 8 && memcmp(got + 18, "\x02\x01" "A\x03\x02\x01" "B\x03", 8) == 0, "urgent flush should keep frame order");
+
+    /// ? Byte limit, and a frame bigger than the queue going out on its own.
+    q.max_bytes = 20;
+    TEST_ASSERT(ucomms_txq_send(&q, "0123456789", 10, 0) == 0 && q.queued == 1, "below the byte limit");
+    TEST_ASSERT(ucomms_txq_send(&q, "0123456789", 10, 0) == 0 && q.queued == 0, "byte limit should flush");
+    static uint8_t big[uCOMMS_TXQ_SIZE * 2];
+    memset(big, 'x', sizeof(big));
+    big[7] = ESC_BYTE;
+    char path[] = "/tmp/ucomms_txq_XXXXXX";
+    int tmp = mkstemp(path);
+    CHECK(tmp >= 0, "mkstemp()");
+    close(tmp);
+    uCOMMS_CAPTURE cap;
+    TEST_ASSERT(ucomms_capture_open(&cap, path) == 0, "capture log should open");
+    q.capture = &cap;
+    TEST_ASSERT(ucomms_txq_send(&q, big, sizeof(big), 0) == 0, "oversized frame should be sent directly");
+    TEST_ASSERT(ucomms_txq_send(&q, big, sizeof(big) / 2 + 1, 0) == 0 && q.big_cap == uCOMMS_ENCODED_MAX(sizeof(big)), "big buffer should be reused");
+    TEST_ASSERT(q.flushes[uCOMMS_FLUSH_BYTES] == 3, "every byte flush should be counted");
+    TEST_ASSERT(q.frames_per_flush[0] == 2 && q.frames_per_flush[1] == 3 && q.frames_per_flush[2] == 2, "frames per flush histogram");
+    TEST_ASSERT(q.frames_sent == 16, "every frame should be counted");
+    ucomms_capture_close(&cap);
+
+    /// ? The capture holds exactly what went on the wire.
+    static uint8_t wire[2][uCOMMS_ENCODED_MAX(sizeof(big))];
+    size_t wire_len = encode_frame(big, sizeof(big), wire[0], sizeof(wire[0]));
+    uCOMMS_CAPTURE_READER rd;
+    uCOMMS_CAPTURE_RECORD rec;
+    TEST_ASSERT(ucomms_capture_map(&rd, path) == 0, "capture log should map");
+    TEST_ASSERT(ucomms_capture_next(&rd, &rec) == 1 && rec.len == wire_len && memcmp(rec.data, wire[0], wire_len) == 0, "oversized frame should be captured encoded");
+    size_t got_len = 0;
+    for (ssize_t r; (r = read(fds[0], wire[1] + got_len, sizeof(wire[1]) - got_len)) > 0;) got_len += (size_t)r;
+    TEST_ASSERT(got_len == 2 * 13 + wire_len + encoded_size(big, sizeof(big) / 2 + 1), "every byte should be on the wire");
+    TEST_ASSERT(memcmp(wire[1] + 2 * 13, wire[0], wire_len) == 0, "oversized frame should go out as captured");
+    ucomms_capture_unmap(&rd);
+    unlink(path);
+
+    ucomms_txq_close(&q);
+    TEST_ASSERT(q.big == NULL, "close should free the big buffer");
+    close(fds[0]);
+    close(fds[1]);
+    printf("    - Test coalescing transmit queue\n");
+    return 1;
+}
+
+static void count_frame(uCOMMS_PORT *port, const uint8_t *payload, size_t len) {
+    (void)payload;
+    (void)len;
+    (*(int *)port->user)++;
+}
+
+int test_capture_replay(void) {
+    char path[] = "/tmp/ucomms_capture_XXXXXX";
+    int tmp = mkstemp(path);
+    CHECK(tmp >= 0, "mkstemp()");
+    close(tmp);
+
+    int master, slave;
+    CHECK(openpty(&master, &slave, NULL, NULL, NULL) == 0, "openpty()");
+    int fd = ucomms_port_open(ttyname(slave));
+    close(slave);
+    TEST_ASSERT(fd >= 0, "pty slave should open as a port");
+
+    uCOMMS_ENGINE eng;
+    uCOMMS_CAPTURE cap;
+    int seen = 0;
+    CHECK(ucomms_engine_init(&eng) == 0, "ucomms_engine_init()");
+    uCOMMS_PORT *port = ucomms_engine_add_port(&eng, fd, count_frame, &seen);
+    TEST_ASSERT(ucomms_capture_open(&cap, path) == 0, "capture log should open");
+    ucomms_port_capture(port, &cap, 5);
+
+    /// ? A good frame, a length mismatch and another good frame come in.
+    const uint8_t rx[] = {
+        START_BYTE, 6, 'T', 'O', 'G', 'G', 'L', 'E', STOP_BYTE,
+        START_BYTE, 5, 'A', STOP_BYTE,
+        START_BYTE, 4, 'G', 'E', 'T', ':', STOP_BYTE,
+    };
+    CHECK(write(master, rx, sizeof(rx)) == (ssize_t)sizeof(rx), "write()");
+    for (int spins = 0; seen < 2 && spins < 50; spins++) ucomms_engine_poll(&eng, 100);
+    TEST_ASSERT(ucomms_port_send(port, "ACK", 3, uCOMMS_TX_URGENT) == 0, "reply should go out");
+    TEST_ASSERT(cap.records >= 2, "both directions should be captured");
+    ucomms_capture_close(&cap);
+
+    /// ? Everything comes back out in order, and replays to the same frames.
+    uCOMMS_CAPTURE_READER rd;
+    uCOMMS_CAPTURE_RECORD rec;
+    TEST_ASSERT(ucomms_capture_map(&rd, path) == 0, "capture log should map");
+    uint8_t got_rx[64], got_tx[64];
+    size_t  rx_len = 0, tx_len = 0;
+    uint64_t last_us = 0;
+    int monotonic = 1, rc;
+    uCOMMS_CONTEXT ctx = {0};
+    int frames = 0, mismatches = 0;
+    while ((rc = ucomms_capture_next(&rd, &rec)) == 1) {
+        TEST_ASSERT(rec.stream == 5, "records should carry the port's stream");
+        monotonic &= rec.time_us >= last_us;
+        last_us = rec.time_us;
+        if (rec.dir == uCOMMS_CAPTURE_TX) {
+            memcpy(got_tx + tx_len, rec.data, rec.len);
+            tx_len += rec.len;
+            continue;
+        }
+        memcpy(got_rx + rx_len, rec.data, rec.len);
+        rx_len += rec.len;
+        for (size_t i = 0; i < rec.len; i++) {
+            uCOMMS_PARSE_STATUS status = parse_cmd(&ctx, (char)rec.data[i]);
+            frames += status == PARSE_FRAME;
+            mismatches += status == PARSE_ERR_LENGTH_MISMATCH;
+        }
+    }
+    TEST_ASSERT(rc == 0 && monotonic, "log should end cleanly with ordered timestamps");
+    TEST_ASSERT(rx_len == sizeof(rx) && memcmp(got_rx, rx, rx_len) == 0, "received bytes should be logged as is");
+    TEST_ASSERT(tx_len == 7 && memcmp(got_tx, "\x02\x10\x23" "ACK\x03", 7) == 0, "sent bytes should be logged encoded");
+    TEST_ASSERT(frames == 2 && mismatches == 1, "replay should reproduce the frames and the error");
+    ucomms_capture_unmap(&rd);
+
+    /// ? A log cut in the middle of a record is reported, not read past.
+    CHECK(truncate(path, (off_t)(uCOMMS_CAPTURE_HEADER + 5)) == 0, "truncate()");
+    TEST_ASSERT(ucomms_capture_map(&rd, path) == 0, "truncated log should still map");
+    TEST_ASSERT(ucomms_capture_next(&rd, &rec) == -1, "truncated record should be reported");
+    ucomms_capture_unmap(&rd);
+
+    /// ? Sessions and muxes log what they send too, retransmits included.
+    int fds[2];
+    CHECK(pipe(fds) == 0, "pipe()");
+    CHECK(fcntl(fds[0], F_SETFL, O_NONBLOCK) == 0, "fcntl()");
+    TEST_ASSERT(ucomms_capture_open(&cap, path) == 0, "capture log should reopen");
+    uCOMMS_SESSION s;
+    SESSION_LOG log = {0};
+    TEST_ASSERT(ucomms_session_init(&s, fds[1], 1, 1, 1) == 0, "session should start");
+    s.crc_mode = uCOMMS_CRC16;
+    ucomms_session_capture(&s, &cap, 1);
+    TEST_ASSERT(ucomms_session_request(&s, "PING", 4, log_reply, &log) == 0, "request should be sent");
+    usleep(2000);
+    TEST_ASSERT(ucomms_session_on_timer(&s) == 1, "request should be retransmitted");
+    static uCOMMS_MUX mux;
+    static uint8_t bulk[300];
+    memset(bulk, ESC_BYTE, sizeof(bulk));
+    ucomms_mux_init(&mux, fds[1]);
+    mux.max_outq = 1 << 20;
+    ucomms_mux_capture(&mux, &cap, 2);
+    TEST_ASSERT(ucomms_mux_send(&mux, 3, bulk, sizeof(bulk)) == 0 && ucomms_mux_pump(&mux, 64) == (int)((sizeof(bulk) + mux.mtu - 1) / mux.mtu), "message should go out in fragments");
+    ucomms_capture_close(&cap);
+    ucomms_session_close(&s);
+
+    static uint8_t wire[4096], logged[4096];
+    ssize_t wire_len = read(fds[0], wire, sizeof(wire));
+    size_t  logged_len = 0;
+    int     streams[3] = {0};
+    TEST_ASSERT(ucomms_capture_map(&rd, path) == 0, "capture log should map");
+    while ((rc = ucomms_capture_next(&rd, &rec)) == 1) {
+        TEST_ASSERT(rec.dir == uCOMMS_CAPTURE_TX && rec.stream >= 1 && rec.stream <= 2, "only sent bytes, on their own streams");
+        streams[rec.stream]++;
+        memcpy(logged + logged_len, rec.data, rec.len);
+        logged_len += rec.len;
+    }
+    TEST_ASSERT(rc == 0 && streams[1] == 2 && streams[2] >= 1, "both attempts and the fragments should be logged");
+    TEST_ASSERT(wire_len > 0 && logged_len == (size_t)wire_len && memcmp(logged, wire, logged_len) == 0, "log should match the wire byte for byte");
+    ucomms_capture_unmap(&rd);
+    close(fds[0]);
+    close(fds[1]);
+
+    ucomms_engine_remove_port(&eng, port);
+    ucomms_engine_close(&eng);
+    close(fd);
+    close(master);
+    unlink(path);
+    printf("    - Test raw capture and replay\n");
+    return 1;
+}
+
+int test_engine_stalled_port(void) {
+    int master[2], fd[2];
+    for (int i = 0; i < 2; i++) {
+        int slave;
+        CHECK(openpty(&master[i], &slave, NULL, NULL, NULL) == 0, "openpty()");
+        fd[i] = ucomms_port_open(ttyname(slave));
+        close(slave);
+        TEST_ASSERT(fd[i] >= 0, "pty slave should open as a port");
+    }
+    CHECK(fcntl(master[0], F_SETFL, O_NONBLOCK) == 0, "fcntl()");
+
+    uCOMMS_ENGINE eng;
+    int seen[2] = {0};
+    CHECK(ucomms_engine_init(&eng) == 0, "ucomms_engine_init()");
+    uCOMMS_PORT *stalled = ucomms_engine_add_port(&eng, fd[0], count_frame, &seen[0]);
+    uCOMMS_PORT *live    = ucomms_engine_add_port(&eng, fd[1], count_frame, &seen[1]);
+
+    /// ? Nobody reads the first device, fill its pty until the queue backs up.
+    char msg[16];
+    int sent = 0, rc = 0;
+    while (sent < 100000) {
+        int n = snprintf(msg, sizeof(msg), "FRAME%06d", sent);
+        if ((rc = ucomms_port_send(stalled, msg, (size_t)n, uCOMMS_TX_URGENT)) < 0) break;
+        sent++;
+    }
+    TEST_ASSERT(rc == -1 && errno == EAGAIN, "backed up queue should refuse with EAGAIN");
+    TEST_ASSERT(ucomms_txq_pending(&stalled->txq) > 0, "unsent bytes should stay queued");
+
+    /// ? The other port keeps being serviced while the first one is stuck.
+    CHECK(ucomms_send(master[1], "PING", 4) == 0, "ucomms_send()");
+    for (int spins = 0; !seen[1] && spins < 50; spins++) ucomms_engine_poll(&eng, 100);
+    TEST_ASSERT(seen[1] == 1, "live port should be serviced next to a stalled one");
+    TEST_ASSERT(stalled->writing && !live->writing, "only the stalled port should wait for EPOLLOUT");
+
+    /// ? Once the device reads, EPOLLOUT sends the rest in order.
+    uCOMMS_CONTEXT ctx = {0};
+    uint8_t chunk[4096];
+    int frames = 0, wrong = 0;
+    for (int spins = 0; frames < sent && spins < 10000; spins++) {
+        ucomms_engine_poll(&eng, 10);
+        ssize_t n = read(master[0], chunk, sizeof(chunk));
+        for (size_t off = 0; n > 0 && off < (size_t)n;) {
+            off += parse_buf(&ctx, chunk + off, (size_t)n - off);
+            if (!frame_ready(&ctx)) continue;
+            int len = snprintf(msg, sizeof(msg), "FRAME%06d", frames++);
+            wrong += ctx.curr_cmd_len != (size_t)len || memcmp(ctx.comms_buf, msg, (size_t)len) != 0;
+        }
+    }
+    TEST_ASSERT(frames == sent && !wrong, "every queued frame should arrive once, in order");
+    ucomms_engine_poll(&eng, 0);
+    TEST_ASSERT(ucomms_txq_pending(&stalled->txq) == 0 && !stalled->writing, "EPOLLOUT should be disarmed once drained");
+
+    ucomms_engine_remove_port(&eng, stalled);
+    ucomms_engine_remove_port(&eng, live);
+    ucomms_engine_close(&eng);
+    for (int i = 0; i < 2; i++) {
+        close(fd[i]);
+        close(master[i]);
+    }
+    printf("    - Test a stalled port does not hold up the engine\n");
+    return 1;
+}
+
+/// ? Receive side of the mux test, remembers every message and its channel.
+typedef struct {
+    int     count;
+    uint8_t chan[8];
+    size_t  len[8];
+    uint8_t data[8][3000];
+} MUX_LOG;
+
+static void log_message(void *user, uint8_t chan, const uint8_t *msg, size_t len) {
+    MUX_LOG *log = user;
+    log->chan[log->count] = chan;
+    log->len[log->count]  = len;
+    memcpy(log->data[log->count++], msg, len);
+}
+
+/// ? Parses everything waiting in the pipe into the receiving mux, returns the
+/// ? channel of every fragment in wire order.
+static int drain_mux(int fd, uCOMMS_MUX *rx, uint8_t *order, int max) {
+    uCOMMS_CONTEXT ctx = {0};
+    uint8_t buf[4096];
+    int frames = 0;
+    ssize_t n;
+    while ((n = read(fd, buf, sizeof(buf))) > 0) {
+        for (size_t off = 0; off < (size_t)n;) {
+            off += parse_buf(&ctx, buf + off, (size_t)n - off);
+            if (!frame_ready(&ctx)) continue;
+            if (frames < max) order[frames] = (uint8_t)ctx.comms_buf[0] & uCOMMS_MUX_CHAN_MASK;
+            frames++;
+            ucomms_mux_on_frame(rx, (const uint8_t *)ctx.comms_buf, ctx.curr_cmd_len);
+        }
+    }
+    return frames;
+}
+
+/// ? Frames read back off a port that carries both plain frames and mux
+/// ? fragments. Plain frames start with 'A' and must match want.
+typedef struct {
+    const uint8_t *want;
+    size_t         want_len;
+    uCOMMS_MUX    *rx;
+    int            plain;
+    int            wrong;
+} PIECE_LOG;
+
+/// ? Runs the engine once and reads a few bytes back, so the port only takes
+/// ? a little at a time and its writes end mid frame.
+static void drain_piece(uCOMMS_ENGINE *eng, int master, uCOMMS_CONTEXT *ctx, PIECE_LOG *got) {
+    uint8_t chunk[251];
+    ucomms_engine_poll(eng, 1);
+    ssize_t n = read(master, chunk, sizeof(chunk));
+    for (size_t off = 0; n > 0 && off < (size_t)n;) {
+        off += parse_buf(ctx, chunk + off, (size_t)n - off);
+        if (!frame_ready(ctx)) continue;
+        const uint8_t *frame = (const uint8_t *)frame_buf(ctx);
+        if (frame[0] == 'A') {
+            got->plain++;
+            got->wrong += ctx->curr_cmd_len != got->want_len || memcmp(frame, got->want, got->want_len) != 0;
+        } else {
+            ucomms_mux_on_frame(got->rx, frame, ctx->curr_cmd_len);
+        }
+    }
+}
+
+int test_mux_scheduling(void) {
+    int fds[2];
+    CHECK(pipe(fds) == 0, "pipe()");
+    CHECK(fcntl(fds[0], F_SETFL, O_NONBLOCK) == 0, "fcntl()");
+    static uCOMMS_MUX tx, rx;
+    static MUX_LOG log;
+    static uint8_t bulk[2500], order[256];
+    for (size_t i = 0; i < sizeof(bulk); i++) bulk[i] = (uint8_t)(i * 7);
+
+    ucomms_mux_init(&tx, fds[1]);
+    ucomms_mux_init(&rx, -1);
+    tx.max_outq = 1 << 20;
+    ucomms_mux_channel(&tx, 0, 0, tx.mtu, NULL, NULL);         /// ? control
+    ucomms_mux_channel(&tx, 1, 1, tx.mtu, NULL, NULL);         /// ? bulk
+    for (uint8_t c = 0; c < 3; c++) ucomms_mux_channel(&rx, c, 0, rx.mtu, log_message, &log);
+
+    /// ? A control message queued behind a bulk transfer overtakes it.
+    TEST_ASSERT(ucomms_mux_send(&tx, 1, bulk, sizeof(bulk)) == 0, "bulk message should queue");
+    TEST_ASSERT(ucomms_mux_pump(&tx, 3) == 3, "pump should respect max_frames");
+    TEST_ASSERT(ucomms_mux_send(&tx, 0, "TOGGLE", 6) == 0, "control message should queue");
+    while (ucomms_mux_pump(&tx, 64) > 0) {}
+    int frames = drain_mux(fds[0], &rx, order, 256);
+    TEST_ASSERT(frames == 1 + (int)((sizeof(bulk) + tx.mtu - 1) / tx.mtu), "bulk should be cut into mtu fragments");
+    TEST_ASSERT(order[2] == 1 && order[3] == 0 && order[4] == 1, "control should go out right after the fragments on the wire");
+    TEST_ASSERT(log.count == 2 && log.chan[0] == 0 && log.len[0] == 6 && memcmp(log.data[0], "TOGGLE", 6) == 0, "control delivered first");
+    TEST_ASSERT(log.chan[1] == 1 && log.len[1] == sizeof(bulk) && memcmp(log.data[1], bulk, sizeof(bulk)) == 0, "bulk reassembled intact");
+
+    /// ? Same priority, twice the quantum gets twice the fragments.
+    ucomms_mux_channel(&tx, 1, 0, (uint16_t)(2 * tx.mtu), NULL, NULL);
+    ucomms_mux_channel(&tx, 2, 0, tx.mtu, NULL, NULL);
+    TEST_ASSERT(ucomms_mux_send(&tx, 1, bulk, sizeof(bulk)) == 0 && ucomms_mux_send(&tx, 2, bulk, sizeof(bulk)) == 0, "queue both");
+    TEST_ASSERT(ucomms_mux_pump(&tx, 30) == 30, "pump 30 fragments");
+    drain_mux(fds[0], &rx, order, 256);
+    int share[3] = {0};
+    for (int i = 0; i < 30; i++) share[order[i]]++;
+    TEST_ASSERT(share[1] == 20 && share[2] == 10, "deficit round robin should follow the quanta");
+    while (ucomms_mux_pump(&tx, 64) > 0) {}
+    drain_mux(fds[0], &rx, order, 256);
+    TEST_ASSERT(log.count == 4 && memcmp(log.data[3], bulk, sizeof(bulk)) == 0, "both transfers should complete");
+
+    /// ? Queue limits.
+    static uint8_t big[uCOMMS_MUX_TXBUF + 1];
+    TEST_ASSERT(ucomms_mux_send(&tx, 2, big, sizeof(big)) == -1 && errno == EMSGSIZE, "oversized message");
+    TEST_ASSERT(ucomms_mux_send(&tx, 2, big, uCOMMS_MUX_TXBUF) == 0, "message filling the ring");
+    TEST_ASSERT(ucomms_mux_send(&tx, 2, "x", 1) == -1 && errno == EAGAIN, "full channel should refuse");
+
+    close(fds[0]);
+    close(fds[1]);
+
+    /// ? On an engine port the mux queues through the port's txq, so a frame
+    /// ? sent on the port and the fragments behind it can both be stuck half
+    /// ? written without ever landing in the middle of each other.
+    int master, slave;
+    CHECK(openpty(&master, &slave, NULL, NULL, NULL) == 0, "openpty()");
+    int fd = ucomms_port_open(ttyname(slave));
+    close(slave);
+    TEST_ASSERT(fd >= 0, "pty slave should open as a port");
+    CHECK(fcntl(master, F_SETFL, O_NONBLOCK) == 0, "fcntl()");
+    uCOMMS_ENGINE eng;
+    int seen = 0;
+    CHECK(ucomms_engine_init(&eng) == 0, "ucomms_engine_init()");
+    uCOMMS_PORT *port = ucomms_engine_add_port(&eng, fd, count_frame, &seen);
+    static MUX_LOG log2;
+    ucomms_mux_init(&tx, fd);
+    ucomms_mux_init(&rx, -1);
+    tx.max_outq = 1 << 20;
+    ucomms_mux_queue(&tx, &port->txq);
+    for (uint8_t c = 0; c < 3; c++) ucomms_mux_channel(&rx, c, 0, rx.mtu, log_message, &log2);
+    ucomms_port_writable(port, ucomms_mux_on_writable, &tx);
+
+    static uint8_t frame[30000];
+    static char    rxbuf[32768];
+    uint8_t junk[1024];
+    memset(junk, 0x55, sizeof(junk));
+    for (size_t i = 0; i < sizeof(frame); i++) frame[i] = (uint8_t)('A' + i % 26);
+    while (write(fd, junk, sizeof(junk)) > 0) {}
+    TEST_ASSERT(errno == EAGAIN, "pty should fill up");
+    TEST_ASSERT(ucomms_port_send(port, frame, sizeof(frame), uCOMMS_TX_URGENT) == 0, "frame should queue");
+    size_t whole = ucomms_txq_pending(&port->txq);
+    TEST_ASSERT(whole > sizeof(frame), "full pty should leave the frame queued");
+
+    /// ? Read just enough for the port to take part of the frame.
+    uCOMMS_CONTEXT ctx = {0};
+    attach_buffer(&ctx, rxbuf, sizeof(rxbuf));
+    PIECE_LOG got = {.want = frame, .want_len = sizeof(frame), .rx = &rx};
+    for (int spins = 0; ucomms_txq_pending(&port->txq) == whole && spins < 5000; spins++) drain_piece(&eng, master, &ctx, &got);
+    size_t stuck = ucomms_txq_pending(&port->txq);
+    TEST_ASSERT(stuck > 0 && stuck < whole, "frame should be stuck half written");
+    TEST_ASSERT(ucomms_mux_send(&tx, 1, bulk, sizeof(bulk)) == 0 && ucomms_mux_send(&tx, 2, bulk, sizeof(bulk)) == 0, "queue both");
+    TEST_ASSERT(ucomms_mux_pump(&tx, 4) == 4, "fragments should queue behind the frame");
+    TEST_ASSERT(tx.out_len == 0 && port->txq.out > 0 && port->txq.big_len > 0, "the port's queue should hold the fragments, not the mux");
+    TEST_ASSERT(ucomms_engine_poll(&eng, 0) == 0 && port->writing, "engine should wait for EPOLLOUT");
+
+    /// ? Keep reading in small pieces, the port gets cut mid fragment too.
+    for (int spins = 0; log2.count < 2 && spins < 20000; spins++) drain_piece(&eng, master, &ctx, &got);
+    TEST_ASSERT(got.plain == 1 && !got.wrong && ctx.dropped_frames == 0, "the frame should arrive once, intact");
+    TEST_ASSERT(log2.count == 2 && memcmp(log2.data[0], bulk, sizeof(bulk)) == 0 && memcmp(log2.data[1], bulk, sizeof(bulk)) == 0, "both transfers should complete once the port drains");
+    ucomms_engine_poll(&eng, 0);
+    TEST_ASSERT(!ucomms_mux_busy(&tx) && !port->writing, "EPOLLOUT should be disarmed once the mux is idle");
+
+    ucomms_engine_remove_port(&eng, port);
+    ucomms_engine_close(&eng);
+    close(fd);
+    close(master);
+    printf("    - Test channel mux priority and deficit round robin\n");
+    return 1;
+}
+
+
+int test_port_config(void) {
+    int master, slave;
+    CHECK(openpty(&master, &slave, NULL, NULL, NULL) == 0, "openpty()");
+
+    /// ? A pty keeps whatever speed it is given, so both paths can be read back.
+    uCOMMS_PORT_CONFIG cfg = uCOMMS_PORT_DEFAULTS, got;
+    cfg.baud  = 3000000;
+    cfg.vmin  = 16;
+    cfg.vtime = 2;
+    cfg.rtscts = 1;
+    cfg.low_latency = 1;
+    TEST_ASSERT(ucomms_port_apply(slave, &cfg) == 0, "standard rate applies, low latency is skipped on a pty");
+    TEST_ASSERT(ucomms_port_get(slave, &got) == 0, "ucomms_port_get()");
+    TEST_ASSERT(got.baud == 3000000 && got.vmin == 16 && got.vtime == 2 && got.rtscts, "settings read back");
+
+    cfg.baud = 1234567;
+    TEST_ASSERT(ucomms_port_apply(slave, &cfg) == 0, "non standard rate goes through BOTHER");
+    TEST_ASSERT(ucomms_port_get(slave, &got) == 0 && got.baud == 1234567, "custom rate reads back");
+
+    TEST_ASSERT(ucomms_port_configure(slave) == 0, "ucomms_port_configure()");
+    TEST_ASSERT(ucomms_port_get(slave, &got) == 0, "ucomms_port_get()");
+    TEST_ASSERT(got.baud == 9600 && got.vmin == 1 && got.vtime == 0 && !got.rtscts, "defaults restored");
+
+    int fds[2];
+    CHECK(pipe(fds) == 0, "pipe()");
+    TEST_ASSERT(ucomms_port_apply(fds[0], &cfg) == -1 && errno == ENOTTY, "a pipe is not a tty");
+
+    close(fds[0]);
+    close(fds[1]);
+    close(master);
+    close(slave);
+    printf("    - Test port settings on a pty\n");
+    return 1;
+}
+
+
+/// ? Payload i of the receive ring test, reserved bytes included.
+static size_t rx_payload(int i, uint8_t *out) {
+    size_t len = 1 + (size_t)(i * 37) % 200;
+    for (size_t k = 0; k < len; k++) out[k] = (uint8_t)(i + k * 7);
+    return len;
+}
+
+/// ? Streams frames through a pipe into the ring, holding a few views at a
+/// ? time. Returns the number of frames that came back intact.
+static int run_rx_ring(uCOMMS_RX_RING *rx, uint8_t crc_mode, int frames) {
+    int fds[2];
+    CHECK(pipe(fds) == 0 && fcntl(fds[0], F_SETFL, O_NONBLOCK) == 0, "pipe()");
+    rx->ctx.crc_mode = crc_mode;
+
+    uCOMMS_RX_VIEW held[4];
+    int nheld = 0, sent = 0, good = 0, want = 0;
+    uint8_t payload[256], wire[600];
+    while (want < frames) {
+        /// ? Keep a few frames in the pipe, with noise in between now and then.
+        while (sent < frames && sent - want < 8) {
+            size_t n = encode_frame_crc(crc_mode, payload, rx_payload(sent, payload), wire, sizeof(wire));
+            if (sent % 5 == 0) CHECK(write(fds[1], "zz", 2) == 2, "write()");
+            CHECK(write(fds[1], wire, n) == (ssize_t)n, "write()");
+            sent++;
+        }
+        if (ucomms_rx_read(rx, fds[0]) < 0) CHECK((errno == ENOBUFS || errno == EAGAIN), "ucomms_rx_read()");
+
+        uCOMMS_RX_VIEW view;
+        while (nheld < 4 && ucomms_rx_next(rx, &view)) {
+            size_t len = rx_payload(want++, payload);
+            if (view.len == len && memcmp(view.ptr, payload, len) == 0) good++;
+            held[nheld++] = view;
+        }
+        /// ? Payloads must still be intact when they are finally released.
+        if (nheld == 4 || want == frames) {
+            for (int i = 0; i < nheld; i++) {
+                size_t len = rx_payload((int)held[i].seq, payload);
+                if (held[i].len != len || memcmp(held[i].ptr, payload, len) != 0) good--;
+                ucomms_rx_release(rx, &held[i]);
+            }
+            nheld = 0;
+        }
+    }
+    close(fds[0]);
+    close(fds[1]);
+    return good;
+}
+
+int test_rx_ring_zero_copy(void) {
+    enum { FRAMES = 500 };
+    uCOMMS_RX_RING rx;
+
+    TEST_ASSERT(ucomms_rx_init(&rx, 4096, 200, uCOMMS_RX_MIRROR) == 0, "mirrored ring");
+    TEST_ASSERT(rx.mirrored, "memfd mirror mapped");
+    TEST_ASSERT(rx.base[0] == rx.base[4096] && (rx.base[1] = 0x5A, rx.base[4097] == 0x5A), "both halves are the same pages");
+    TEST_ASSERT(run_rx_ring(&rx, uCOMMS_CRC_NONE, FRAMES) == FRAMES, "frames through the wrap come out whole");
+    TEST_ASSERT(rx.head > 8 * rx.size, "ring wrapped many times");
+    TEST_ASSERT(rx.tail == rx.scan && rx.emitted == rx.released, "everything released");
+    ucomms_rx_close(&rx);
+
+    TEST_ASSERT(ucomms_rx_init(&rx, 2048, 200, 0) == 0 && !rx.mirrored, "copying ring");
+    TEST_ASSERT(run_rx_ring(&rx, uCOMMS_CRC32C, FRAMES) == FRAMES, "CRC frames through the copying ring");
+    TEST_ASSERT(rx.ctx.dropped_frames == 0, "no frame dropped");
+
+    /// ? Views point into the ring itself, an unescaped payload is not moved.
+    int fds[2];
+    CHECK(pipe(fds) == 0, "pipe()");
+    uint8_t wire[64];
+    size_t n = encode_frame((const uint8_t *)"ZERO", 4, wire, sizeof(wire));
+    uint64_t at = rx.head;
+    uCOMMS_RX_VIEW view;
+    rx.ctx.crc_mode = uCOMMS_CRC_NONE;
+    /// ? Split right after START_BYTE, the length then arrives on its own.
+    CHECK(write(fds[1], wire, 1) == 1, "write()");
+    TEST_ASSERT(ucomms_rx_read(&rx, fds[0]) == 1 && ucomms_rx_next(&rx, &view) == 0, "START_BYTE alone is no frame");
+    CHECK(write(fds[1], wire + 1, n - 1) == (ssize_t)(n - 1), "write()");
+    TEST_ASSERT(ucomms_rx_read(&rx, fds[0]) == (ssize_t)(n - 1) && ucomms_rx_next(&rx, &view) == 1, "frame read in place");
+    TEST_ASSERT((((size_t)(view.ptr - rx.base) ^ (at + 2)) & (rx.size - 1)) == 0 && memcmp(view.ptr, "ZERO", 5) == 0, "view points at the bytes read");
+
+    /// ? A held view keeps its bytes, the ring refuses to read over them.
+    static uint8_t junk[4096];
+    CHECK(fcntl(fds[0], F_SETFL, O_NONBLOCK) == 0 && write(fds[1], junk, sizeof(junk)) == (ssize_t)sizeof(junk), "write()");
+    while (ucomms_rx_read(&rx, fds[0]) > 0) {
+        uCOMMS_RX_VIEW none;
+        CHECK(ucomms_rx_next(&rx, &none) == 0, "ucomms_rx_next()");
+    }
+    TEST_ASSERT(errno == ENOBUFS && rx.full == 1, "read stops at the held frame");
+    TEST_ASSERT(memcmp(view.ptr, "ZERO", 5) == 0, "held frame untouched");
+    ucomms_rx_release(&rx, &view);
+    TEST_ASSERT(ucomms_rx_read(&rx, fds[0]) > 0, "released bytes are read into again");
+
+    close(fds[0]);
+    close(fds[1]);
+    ucomms_rx_close(&rx);
+
+    /// ? The very first frame may already be too big for comms_buf, with the
+    /// ? length peeked along with START_BYTE or arriving on its own.
+    uint8_t payload[150], big[400];
+    for (size_t i = 0; i < sizeof(payload); i++) payload[i] = (uint8_t)(i * 3);
+    n = encode_frame(payload, sizeof(payload), big, sizeof(big));
+    for (size_t split = 1; split <= n; split += n - 1) {
+        TEST_ASSERT(ucomms_rx_init(&rx, 4096, 200, 0) == 0, "fresh ring");
+        CHECK(pipe(fds) == 0 && fcntl(fds[0], F_SETFL, O_NONBLOCK) == 0, "pipe()");
+        CHECK(write(fds[1], big, split) == (ssize_t)split, "write()");
+        int got = ucomms_rx_read(&rx, fds[0]) > 0 && ucomms_rx_next(&rx, &view);
+        if (split < n) {
+            CHECK(write(fds[1], big + split, n - split) == (ssize_t)(n - split), "write()");
+            got = ucomms_rx_read(&rx, fds[0]) > 0 && ucomms_rx_next(&rx, &view);
+        }
+        TEST_ASSERT(got && view.len == sizeof(payload) && memcmp(view.ptr, payload, sizeof(payload)) == 0, "first frame above 62 bytes comes out whole");
+        TEST_ASSERT(rx.ctx.dropped_frames == 0, "first frame not dropped");
+        ucomms_rx_release(&rx, &view);
+        close(fds[0]);
+        close(fds[1]);
+        ucomms_rx_close(&rx);
+    }
+    printf("    - Test zero copy receive ring, mirrored and copying\n");
+    return 1;
+}
+
+
+int main(void) {
+    printf("=== uComms I/O Tests ===\n\n");
+
+    RUN_TEST(test_send_matches_encoder);
+    RUN_TEST(test_send_batch_partial_writes);
+    RUN_TEST(test_engine_many_ptys);
+    RUN_TEST(test_reader_thread_ring);
+    RUN_TEST(test_session_pipelining);
+    RUN_TEST(test_txq_coalescing);
+    RUN_TEST(test_capture_replay);
+    RUN_TEST(test_engine_stalled_port);
+    RUN_TEST(test_mux_scheduling);
+    RUN_TEST(test_port_config);
+    RUN_TEST(test_rx_ring_zero_copy);
+
+    // Print summary
+    printf("=== Test Summary ===\n");
+    printf("Total tests: %d\n", total_tests);
+    printf("Passed: %d\n", tests_passed);
+    printf("Failed: %d\n", tests_failed);
+    printf("Success rate: %.1f%%\n", (float)tests_passed / total_tests * 100);
+
+    // Return 0 for success, 1 for failure
+    return (tests_failed == 0) ? 0 : 1;
+}
@@ -8,63 +8,12 @@
 // Include your header files
 #include "checks.h"
 #include "ucoms.h"  // Contains parse_cmd function and types
-
-
-// Test helper macros
-#define TEST_ASSERT(condition, message)             \
-    do {                                            \
-        if (!(condition)) {                         \
-            fprintf(stderr, "FAIL: %s\n", message); \
-            return 0;                               \
-        } else {                                    \
-            printf("PASS: %s\n", message);          \
-        }                                           \
-    } while(0)
-
-
-// Test for functions expected to crash/exit
-#define TEST_EXPECT_CRASH(test_code, message)                                              \
-    do {                                                                                   \
-        pid_t pid = fork();                                                                \
-        if (pid == 0) {                                                                    \
-            test_code;                                                                     \
-            exit(0);                                                                       \
-        } else if (pid > 0) {                                                              \
-            int status;                                                                    \
-            waitpid(pid, &status, 0);                                                      \
-            if (WIFEXITED(status) && WEXITSTATUS(status) == 0) {                           \
-                fprintf(stderr, "FAIL: %s (expected crash but didn't crash)\n", message);  \
-                return 0;                                                                  \
-            } else {                                                                       \
-                printf("PASS: %s (crashed as expected)\n", message);                       \
-            }                                                                              \
-        } else {                                                                           \
-            fprintf(stderr, "FAIL: fork() failed for crash test\n");                       \
-            return 0;                                                                      \
-        }                                                                                  \
-    } while(0)
-
-
-#define RUN_TEST(test_func)                         \
-    do {                                            \
-        printf("Running %s...\n", #test_func);      \
-        if (test_func()) {                          \
-            printf("✓ %s passed\n\n", #test_func);  \
-            tests_passed++;                         \
-        } else {                                    \
-            printf("✗ %s failed\n\n", #test_func);  \
-            tests_failed++;                         \
-        }                                           \
-        total_tests++;                              \
-    } while(0)
-
-
-
-
-/// ? Test counters
-static int tests_passed = 0;
-static int tests_failed = 0;
-static int total_tests = 0;
+#include "frame.h"  // Frame encoder
+#include "pool.h"   // Frame buffer pool
+#include "tlv.h"    // Binary payloads
+#include "lz.h"     // Payload compression
+#include "group.h"  // Multi-stream parser
+#include "test_harness.h"
 
 
 
@@ -234,6 +183,852 @@ int test_null_pointer_should_crash(void) {
 }
 
 
+/// ? Collected frames, flattened as {len, payload...} records.
+typedef struct {
+    uint8_t bytes[4096];
+    size_t  len;
+    int     count;
+} FRAME_LOG;
+
+static void log_frame(FRAME_LOG *log, const uCOMMS_CONTEXT *ctx) {
+    log->bytes[log->len++] = ctx->curr_cmd_len;
+    memcpy(log->bytes + log->len, ctx->comms_buf, ctx->curr_cmd_len);
+    log->len += ctx->curr_cmd_len;
+    log->count++;
+}
+
+/// ? Builds a stream of valid frames with line noise in between them.
+static size_t build_stream(uint8_t *out, int frames, unsigned seed) {
+    size_t n = 0;
+    srand(seed);
+    for (int f = 0; f < frames; f++) {
+        int noise = rand() % 4;
+        for (int k = 0; k < noise; k++) out[n++] = 'a' + rand() % 26;
+
+        uint8_t len;
+        do { len = (uint8_t)(rand() % 60); } while (len == START_BYTE || len == STOP_BYTE || len == ESC_BYTE);
+        out[n++] = START_BYTE;
+        out[n++] = len;
+        for (int k = 0; k < len; k++) {
+            uint8_t b;
+            do { b = (uint8_t)rand(); } while (b == START_BYTE || b == STOP_BYTE || b == ESC_BYTE);
+            out[n++] = b;
+        }
+        out[n++] = STOP_BYTE;
+    }
+    return n;
+}
+
+int test_parse_buf_matches_parse_cmd(void) {
+    static uint8_t stream[8192];
+    static FRAME_LOG by_byte, by_buf;
+    size_t len = build_stream(stream, 100, 42);
+    memset(&by_byte, 0, sizeof(by_byte));
+    memset(&by_buf, 0, sizeof(by_buf));
+
+    uCOMMS_CONTEXT ctx = {0};
+    for (size_t i = 0; i < len; i++) {
+        parse_cmd(&ctx, (char)stream[i]);
+        if (stream[i] == STOP_BYTE && frame_ready(&ctx)) log_frame(&by_byte, &ctx);
+    }
+
+    /// ? Random chunk sizes, frames straddle chunk boundaries.
+    reset_comms_context(&ctx);
+    size_t off = 0;
+    while (off < len) {
+        size_t chunk = 1 + (size_t)rand() % 97;
+        if (chunk > len - off) chunk = len - off;
+        const uint8_t *p = stream + off;
+        size_t left = chunk;
+        while (left) {
+            size_t n = parse_buf(&ctx, p, left);
+            p += n;
+            left -= n;
+            if (frame_ready(&ctx)) log_frame(&by_buf, &ctx);
+        }
+        off += chunk;
+    }
+
+    printf("[EXPECTED]: %d frames : [GOT]: %d frames\n", by_byte.count, by_buf.count);
+    TEST_ASSERT(by_byte.count == 100, "byte path should decode every frame");
+    TEST_ASSERT(by_buf.count == by_byte.count, "parse_buf should decode the same number of frames");
+    TEST_ASSERT(by_buf.len == by_byte.len && memcmp(by_buf.bytes, by_byte.bytes, by_byte.len) == 0,
+                "parse_buf frames should match parse_cmd frames");
+    printf("    - Test bulk parsing against the byte path\n");
+    return 1;
+}
+
+int test_find_special(void) {
+    uint8_t buf[100];
+    memset(buf, 'x', sizeof(buf));
+    TEST_ASSERT(ucomms_find_special(buf, sizeof(buf)) == sizeof(buf), "clean buffer has no reserved byte");
+
+    /// ? Every position, so each of the AVX2/SSE2/word/tail loops gets hit.
+    for (size_t pos = 0; pos < sizeof(buf); pos++) {
+        buf[pos] = ESC_BYTE;
+        if (ucomms_find_special(buf, sizeof(buf)) != pos) {
+            fprintf(stderr, "FAIL: reserved byte at %zu not found\n", pos);
+            return 0;
+        }
+        buf[pos] = 'x';
+    }
+    buf[40] = STOP_BYTE;
+    buf[70] = START_BYTE;
+    TEST_ASSERT(ucomms_find_special(buf, sizeof(buf)) == 40, "first reserved byte wins");
+    printf("    - Test reserved byte scanning\n");
+    return 1;
+}
+
+int test_parse_error_status(void) {
+    uCOMMS_CONTEXT ctx = {0};
+
+    TEST_ASSERT(parse_cmd(&ctx, STOP_BYTE) == PARSE_ERR_NO_START, "STOP without START should be reported");
+
+    parse_cmd(&ctx, START_BYTE);
+    TEST_ASSERT(parse_cmd(&ctx, STOP_BYTE) == PARSE_ERR_NO_LENGTH, "STOP without length should be reported");
+
+    parse_cmd(&ctx, START_BYTE);
+    parse_cmd(&ctx, 5);
+    parse_cmd(&ctx, 'A');
+    TEST_ASSERT(parse_cmd(&ctx, STOP_BYTE) == PARSE_ERR_LENGTH_MISMATCH, "length mismatch should be reported");
+
+    parse_cmd(&ctx, START_BYTE);
+    TEST_ASSERT(parse_cmd(&ctx, 70) == PARSE_ERR_OVERFLOW, "oversized length should be reported");
+    TEST_ASSERT(!frame_open(&ctx), "parser should be hunting for START after an error");
+
+    TEST_ASSERT(ctx.dropped_frames == 4, "every error should count a dropped frame");
+
+    parse_cmd(&ctx, START_BYTE);
+    parse_cmd(&ctx, 4);
+    TEST_ASSERT(parse_cmd(&ctx, STOP_BYTE) == PARSE_ERR_LENGTH_MISMATCH, "short frame should be reported");
+    TEST_ASSERT(ctx.dropped_frames == 5, "dropped frames should survive reset_comms_context()");
+    printf("    - Test non-fatal parse errors\n");
+    return 1;
+}
+
+int test_resync_within_chunk(void) {
+    const uint8_t chunk[] = {
+        START_BYTE, 5, 'A', STOP_BYTE,                      /// ? length mismatch
+        STOP_BYTE,                                          /// ? stray STOP
+        START_BYTE, 70, 'x', 'y', 'z',                      /// ? oversized frame
+        START_BYTE, 4, 'G', 'E', 'T', ':', STOP_BYTE,       /// ? good frame
+        'n', 'o', 'i', 's', 'e',
+        START_BYTE, 6, 'T', 'O', 'G', 'G', 'L', 'E', STOP_BYTE,
+    };
+    uCOMMS_CONTEXT ctx = {0};
+    const uint8_t *p = chunk;
+    size_t left = sizeof(chunk);
+    int frames = 0;
+
+    while (left) {
+        size_t n = parse_buf(&ctx, p, left);
+        p += n;
+        left -= n;
+        if (!frame_ready(&ctx)) continue;
+        frames++;
+        if (frames == 1) TEST_ASSERT(strcmp(ctx.comms_buf, "GET:") == 0, "first good frame should be GET:");
+        if (frames == 2) TEST_ASSERT(strcmp(ctx.comms_buf, "TOGGLE") == 0, "second good frame should be TOGGLE");
+    }
+
+    TEST_ASSERT(frames == 2, "both good frames should be decoded from the same chunk");
+    TEST_ASSERT(ctx.dropped_frames == 3, "three bad frames should be counted");
+    printf("    - Test resync after corrupted frames\n");
+    return 1;
+}
+
+int test_truncated_frames(void) {
+    /// ? Each frame is cut short by the START_BYTE of the next one.
+    const uint8_t stream[] = {
+        START_BYTE, 5, 'A', 'B',                            /// ? cut in the payload
+        START_BYTE, 0x81,                                   /// ? cut in the length
+        START_BYTE,                                         /// ? cut right after START
+        START_BYTE, 4, 'G', 'E', 'T', ':', STOP_BYTE,       /// ? good frame
+        START_BYTE, 1, ESC_BYTE,                            /// ? cut in an escape
+        START_BYTE, 4, 'O', 'K', 'A', 'Y', STOP_BYTE,
+    };
+    static uCOMMS_STATS st;
+    uCOMMS_CONTEXT by_byte = {.stats = &st}, by_buf = {0};
+    int frames = 0;
+    for (size_t i = 0; i < sizeof(stream); i++) {
+        uCOMMS_PARSE_STATUS status = parse_cmd(&by_byte, (char)stream[i]);
+        if (stream[i] == START_BYTE) TEST_ASSERT(status == PARSE_OK, "START_BYTE still opens the next frame");
+        frames += status == PARSE_FRAME;
+    }
+    for (size_t off = 0; off < sizeof(stream);) {
+        off += parse_buf(&by_buf, stream + off, sizeof(stream) - off);
+        frames += frame_ready(&by_buf);
+    }
+
+    TEST_ASSERT(frames == 4, "frames after a truncated one are decoded");
+    TEST_ASSERT(by_byte.dropped_frames == 4 && by_buf.dropped_frames == 4, "truncated frames are counted as dropped");
+    TEST_ASSERT(st.truncated == 4 && st.resyncs == 4, "truncated frames are counted as resyncs");
+    printf("    - Test frames cut short by a START_BYTE\n");
+    return 1;
+}
+
+int test_escape_roundtrip(void) {
+    static uint8_t stream[16384];
+    static uint8_t payloads[uCOMMS_MAX_PAYLOAD + 1][uCOMMS_MAX_PAYLOAD];
+    static FRAME_LOG by_byte, by_buf;
+    memset(&by_byte, 0, sizeof(by_byte));
+    memset(&by_buf, 0, sizeof(by_buf));
+
+    /// ? Every length, including the reserved ones, with plenty of reserved bytes.
+    size_t len = 0;
+    srand(7);
+    for (int f = 0; f <= uCOMMS_MAX_PAYLOAD; f++) {
+        for (int k = 0; k < f; k++) {
+            payloads[f][k] = (rand() % 4) ? (uint8_t)rand() : (uint8_t)(START_BYTE + rand() % 2);
+        }
+        size_t n = encode_frame(payloads[f], f, stream + len, sizeof(stream) - len);
+        TEST_ASSERT(n == encoded_size(payloads[f], f), "encoded size should match encoded_size()");
+        len += n;
+    }
+
+    uCOMMS_CONTEXT ctx = {0};
+    for (size_t i = 0; i < len; i++) {
+        if (parse_cmd(&ctx, (char)stream[i]) == PARSE_FRAME) log_frame(&by_byte, &ctx);
+    }
+
+    reset_comms_context(&ctx);
+    const uint8_t *p = stream;
+    size_t left = len;
+    while (left) {
+        size_t n = parse_buf(&ctx, p, left < 13 ? left : 13);
+        p += n;
+        left -= n;
+        if (frame_ready(&ctx)) log_frame(&by_buf, &ctx);
+    }
+
+    TEST_ASSERT(by_byte.count == uCOMMS_MAX_PAYLOAD + 1, "every escaped frame should decode");
+    TEST_ASSERT(ctx.dropped_frames == 0, "no escaped frame should be dropped");
+    TEST_ASSERT(by_buf.len == by_byte.len && memcmp(by_buf.bytes, by_byte.bytes, by_byte.len) == 0,
+                "parse_buf should decode escapes like parse_cmd");
+
+    size_t off = 0;
+    for (int f = 0; f <= uCOMMS_MAX_PAYLOAD; f++) {
+        if (by_byte.bytes[off] != f || memcmp(by_byte.bytes + off + 1, payloads[f], f) != 0) {
+            fprintf(stderr, "FAIL: frame %d did not round trip\n", f);
+            return 0;
+        }
+        off += 1 + f;
+    }
+    printf("    - Test escaped frames round trip\n");
+    return 1;
+}
+
+int test_encode_clean_payload(void) {
+    const uint8_t clean[] = {'T', 'O', 'G', 'G', 'L', 'E'};
+    const uint8_t dirty[] = {'A', START_BYTE, 'B', ESC_BYTE};
+    uint8_t out[uCOMMS_ENCODED_MAX(8)];
+
+    TEST_ASSERT(payload_is_clean(clean, sizeof(clean)), "TOGGLE should be clean");
+    TEST_ASSERT(!payload_is_clean(dirty, sizeof(dirty)), "payload with START and ESC should not be clean");
+
+    const uint8_t expected[] = {START_BYTE, 6, 'T', 'O', 'G', 'G', 'L', 'E', STOP_BYTE};
+    TEST_ASSERT(encode_frame(clean, sizeof(clean), out, sizeof(out)) == sizeof(expected), "clean frame has no overhead");
+    TEST_ASSERT(memcmp(out, expected, sizeof(expected)) == 0, "clean frame should match the hand built one");
+
+    const uint8_t escaped[] = {START_BYTE, 4, 'A', ESC_BYTE, START_BYTE ^ uCOMMS_ESC_XOR, 'B',
+                               ESC_BYTE, ESC_BYTE ^ uCOMMS_ESC_XOR, STOP_BYTE};
+    TEST_ASSERT(encode_frame(dirty, sizeof(dirty), out, sizeof(out)) == sizeof(escaped), "dirty frame size");
+    TEST_ASSERT(memcmp(out, escaped, sizeof(escaped)) == 0, "reserved bytes should be escaped");
+    TEST_ASSERT(encode_frame(dirty, sizeof(dirty), out, sizeof(escaped) - 1) == 0, "short output buffer should fail");
+    printf("    - Test frame encoder\n");
+    return 1;
+}
+
+/// ? What the last dispatched handler saw.
+typedef struct {
+    int         id;
+    int         calls;
+    uCOMMS_VIEW cmd;
+    uCOMMS_VIEW args;
+} DISPATCH_HIT;
+
+static DISPATCH_HIT last_hit;
+
+static void record_hit(uCOMMS_VIEW cmd, uCOMMS_VIEW args, void *user) {
+    last_hit.id   = (int)(intptr_t)user;
+    last_hit.cmd  = cmd;
+    last_hit.args = args;
+    last_hit.calls++;
+}
+
+int test_dispatch_table(void) {
+    enum { GENERATED = 400 };
+    static uCOMMS_DISPATCH table;
+    static char names[GENERATED][12];
+    dispatch_init(&table);
+
+    TEST_ASSERT(dispatch_register(&table, "TOGGLE", record_hit, (void *)1) == 0, "TOGGLE should register");
+    TEST_ASSERT(dispatch_register(&table, "GET:", record_hit, (void *)2) == 0, "GET: prefix should register");
+    for (int i = 0; i < GENERATED; i++) {
+        snprintf(names[i], sizeof(names[i]), "CMD%d", i);
+        CHECK(dispatch_register(&table, names[i], record_hit, (void *)(intptr_t)(100 + i)) == 0, "register");
+    }
+    TEST_ASSERT(dispatch_register(&table, "TOGGLE", record_hit, NULL) == -1, "duplicate command should be refused");
+    TEST_ASSERT(dispatch_register(&table, "GET:FR", record_hit, NULL) == -1, "key with arguments should be refused");
+    TEST_ASSERT(dispatch_build(&table) == 0, "perfect hash should build for hundreds of commands");
+
+    uCOMMS_CONTEXT ctx = {0};
+    ctx.dispatch = &table;
+    const uint8_t frames[] = {
+        START_BYTE, 6, 'G', 'E', 'T', ':', 'F', 'R', STOP_BYTE,
+    };
+    for (size_t i = 0; i < sizeof(frames); i++) parse_cmd(&ctx, (char)frames[i]);
+    TEST_ASSERT(last_hit.calls == 1 && last_hit.id == 2, "GET:FR should reach the GET: handler");
+    TEST_ASSERT(last_hit.cmd.ptr == ctx.comms_buf && last_hit.cmd.len == 6, "handler should get a view of comms_buf");
+    TEST_ASSERT(last_hit.args.ptr == ctx.comms_buf + 4 && last_hit.args.len == 2, "arguments should follow the prefix");
+
+    /// ? Every generated command lands on its own handler.
+    for (int i = 0; i < GENERATED; i++) {
+        uint8_t frame[uCOMMS_ENCODED_MAX(12)];
+        size_t n = encode_frame((const uint8_t *)names[i], strlen(names[i]), frame, sizeof(frame));
+        for (size_t k = 0; k < n; k++) parse_cmd(&ctx, (char)frame[k]);
+        if (last_hit.id != 100 + i) {
+            fprintf(stderr, "FAIL: %s dispatched to %d\n", names[i], last_hit.id);
+            return 0;
+        }
+    }
+
+    int calls = last_hit.calls;
+    const uint8_t unknown[] = {START_BYTE, 4, 'N', 'O', 'P', 'E', STOP_BYTE};
+    for (size_t i = 0; i < sizeof(unknown); i++) parse_cmd(&ctx, (char)unknown[i]);
+    TEST_ASSERT(last_hit.calls == calls, "unknown command should not call a handler");
+    TEST_ASSERT(ctx.unknown_cmds == 1, "unknown command should be counted");
+    printf("    - Test perfect hash command dispatch\n");
+    return 1;
+}
+
+int test_crc_check_values(void) {
+    const uint8_t check[] = "123456789";
+    TEST_ASSERT(crc_compute(uCOMMS_CRC16, check, 9) == 0x29B1, "CRC-16/CCITT-FALSE check value");
+    TEST_ASSERT(crc_compute(uCOMMS_CRC32C, check, 9) == 0xE3069283u, "CRC-32C check value");
+
+    /// ? Slice-by-8 and the crc32 instruction must agree on every length.
+    uint8_t buf[300];
+    for (size_t i = 0; i < sizeof(buf); i++) buf[i] = (uint8_t)(i * 131 + 7);
+    for (size_t n = 0; n <= sizeof(buf); n++) {
+        uint32_t sw = ~crc32c_update_sw(crc_begin(uCOMMS_CRC32C), buf, n);
+        if (sw != crc_compute(uCOMMS_CRC32C, buf, n)) {
+            fprintf(stderr, "FAIL: CRC-32C paths disagree at length %zu\n", n);
+            return 0;
+        }
+    }
+    printf("    - Test CRC check values\n");
+    return 1;
+}
+
+int test_crc_frames(void) {
+    const uint8_t modes[] = {uCOMMS_CRC16, uCOMMS_CRC32C};
+    static uint8_t stream[8192];
+
+    for (size_t m = 0; m < sizeof(modes); m++) {
+        size_t len = 0;
+        int frames = 0;
+        srand(11);
+        for (int f = 0; f <= uCOMMS_MAX_PAYLOAD; f++) {
+            uint8_t payload[uCOMMS_MAX_PAYLOAD];
+            for (int k = 0; k < f; k++) payload[k] = (uint8_t)rand();
+            len += encode_frame_crc(modes[m], payload, f, stream + len, sizeof(stream) - len);
+        }
+
+        uCOMMS_CONTEXT by_byte = {.crc_mode = modes[m]};
+        for (size_t i = 0; i < len; i++) frames += parse_cmd(&by_byte, (char)stream[i]) == PARSE_FRAME;
+        TEST_ASSERT(frames == uCOMMS_MAX_PAYLOAD + 1 && by_byte.dropped_frames == 0, "byte path should accept every CRC frame");
+
+        uCOMMS_CONTEXT by_buf = {.crc_mode = modes[m]};
+        frames = 0;
+        for (size_t off = 0; off < len;) {
+            off += parse_buf(&by_buf, stream + off, len - off);
+            frames += frame_ready(&by_buf);
+        }
+        TEST_ASSERT(frames == uCOMMS_MAX_PAYLOAD + 1 && by_buf.dropped_frames == 0, "parse_buf should accept every CRC frame");
+
+#ifndef uCOMMS_FATAL_PARSE_ERRORS
+        /// ? One flipped payload bit has to be caught.
+        const uint8_t toggle[] = {'T', 'O', 'G', 'G', 'L', 'E'};
+        uint8_t frame[uCOMMS_ENCODED_MAX(6)];
+        size_t n = encode_frame_crc(modes[m], toggle, sizeof(toggle), frame, sizeof(frame));
+        frame[4] ^= 0x01;
+        uCOMMS_PARSE_STATUS status = PARSE_OK;
+        for (size_t i = 0; i < n; i++) status = parse_cmd(&by_byte, (char)frame[i]);
+        TEST_ASSERT(status == PARSE_ERR_CRC, "corrupted frame should fail the CRC");
+        TEST_ASSERT(by_byte.dropped_frames == 1, "corrupted frame should be dropped");
+#endif
+    }
+    printf("    - Test CRC trailers on both parse paths\n");
+    return 1;
+}
+
+int test_large_frames(void) {
+    static char big_buf[4096];
+    static uint8_t payload[4000];
+    static uint8_t stream[4 * uCOMMS_ENCODED_MAX(4000)];
+    const size_t lens[] = {0, 62, 63, 127, 128, 129, 300, 1000, 4000};
+    const size_t count = sizeof(lens) / sizeof(lens[0]);
+
+    for (size_t i = 0; i < sizeof(payload); i++) payload[i] = (uint8_t)(i * 7);   /// ? has reserved bytes
+
+    uint8_t len_field[6];
+    TEST_ASSERT(encode_length(100, len_field) == 1 && len_field[0] == 100, "short lengths stay a single byte");
+    TEST_ASSERT(encode_length(1000, len_field) == 2, "longer lengths become a varint");
+
+    for (uint8_t crc = uCOMMS_CRC_NONE; crc <= uCOMMS_CRC32C; crc++) {
+        size_t len = 0;
+        for (size_t f = 0; f < count; f++) {
+            len += encode_frame_crc(crc, payload, lens[f], stream + len, sizeof(stream) - len);
+        }
+
+        uCOMMS_CONTEXT by_byte = {.crc_mode = crc};
+        attach_buffer(&by_byte, big_buf, sizeof(big_buf));
+        size_t got = 0;
+        for (size_t i = 0; i < len; i++) {
+            if (parse_cmd(&by_byte, (char)stream[i]) != PARSE_FRAME) continue;
+            if (by_byte.curr_cmd_len != lens[got] || memcmp(frame_buf(&by_byte), payload, lens[got]) != 0) {
+                fprintf(stderr, "FAIL: frame of %zu bytes came out wrong\n", lens[got]);
+                return 0;
+            }
+            got++;
+        }
+        TEST_ASSERT(got == count, "byte path should decode every large frame");
+
+        uCOMMS_CONTEXT by_buf = {.crc_mode = crc};
+        attach_buffer(&by_buf, big_buf, sizeof(big_buf));
+        got = 0;
+        for (size_t off = 0; off < len;) {
+            off += parse_buf(&by_buf, stream + off, len - off);
+            if (frame_ready(&by_buf)) {
+                if (by_buf.curr_cmd_len != lens[got] || memcmp(frame_buf(&by_buf), payload, lens[got]) != 0) {
+                    fprintf(stderr, "FAIL: bulk frame of %zu bytes came out wrong\n", lens[got]);
+                    return 0;
+                }
+                got++;
+            }
+        }
+        TEST_ASSERT(got == count && by_buf.dropped_frames == 0, "parse_buf should decode every large frame");
+    }
+
+#ifndef uCOMMS_FATAL_PARSE_ERRORS
+    /// ? The embedded buffer still turns big frames away and keeps going.
+    size_t len = encode_frame(payload, 300, stream, sizeof(stream));
+    len += encode_frame((const uint8_t *)"TOGGLE", 6, stream + len, sizeof(stream) - len);
+    uCOMMS_CONTEXT small = {0};
+    int frames = 0;
+    for (size_t i = 0; i < len; i++) frames += parse_cmd(&small, (char)stream[i]) == PARSE_FRAME;
+    TEST_ASSERT(frames == 1 && small.dropped_frames == 1, "embedded buffer should drop the big frame only");
+    TEST_ASSERT(strcmp(small.comms_buf, "TOGGLE") == 0, "small frame should land in comms_buf");
+#endif
+    printf("    - Test varint lengths and external buffers\n");
+    return 1;
+}
+
+int test_pool_buffers(void) {
+    static uint64_t mem[4 * 1024 / 8];
+    uCOMMS_POOL pool;
+    TEST_ASSERT(pool_init(&pool, mem, sizeof(mem), 1024) == 4, "4 KiB should give 4 slabs of 1 KiB");
+
+    uCOMMS_CONTEXT ports[5];
+    memset(ports, 0, sizeof(ports));
+    for (int i = 0; i < 4; i++) TEST_ASSERT(attach_pool_buffer(&ports[i], &pool) == 0, "slab should attach");
+    TEST_ASSERT(attach_pool_buffer(&ports[4], &pool) == -1, "empty pool should refuse");
+    TEST_ASSERT(frame_cap(&ports[0]) == 1024 && frame_cap(&ports[4]) == uCOMMS_CONTEXT_BUFFER_SIZE,
+                "attached contexts should use the slab size");
+    TEST_ASSERT(ports[0].ext_buf != ports[1].ext_buf, "slabs should be distinct");
+
+    release_pool_buffer(&ports[2], &pool);
+    TEST_ASSERT(pool.in_use == 3 && frame_buf(&ports[2]) == ports[2].comms_buf, "released context uses comms_buf again");
+    TEST_ASSERT(attach_pool_buffer(&ports[4], &pool) == 0, "released slab should be reused");
+    printf("    - Test frame buffer pool\n");
+    return 1;
+}
+
+int test_stats_counters(void) {
+    /// ? Bucket edges: exact below 8, then 8 sub-buckets per power of 2.
+    TEST_ASSERT(hist_bucket(7) == 7 && hist_bucket(8) == 8 && hist_bucket(15) == 15 && hist_bucket(16) == 16, "small buckets");
+    TEST_ASSERT(hist_bucket(17) == 16 && hist_bucket(18) == 17, "sub-buckets above 16 should be 2 wide");
+    TEST_ASSERT(hist_bucket(UINT64_MAX) == uCOMMS_HIST_BUCKETS - 1, "largest value should land in the last bucket");
+    for (uint64_t v = 1; v < ((uint64_t)1 << 62); v = v * 3 + 1) {
+        uint64_t lo = hist_bucket_value(hist_bucket(v));
+        TEST_ASSERT(lo <= v && v - lo <= v / 8, "bucket should be within 12.5% of the value");
+    }
+
+    static uCOMMS_HIST h;
+    for (uint64_t v = 1; v <= 1000; v++) hist_record(&h, v);
+    TEST_ASSERT(h.count == 1000 && h.max == 1000, "histogram count and max");
+    uint64_t p50 = hist_quantile(&h, 0.5), p99 = hist_quantile(&h, 0.99);
+    TEST_ASSERT(p50 >= 448 && p50 <= 501, "p50 should be close to 500");
+    TEST_ASSERT(p99 >= 896 && p99 <= 991, "p99 should be close to 990");
+
+#ifndef uCOMMS_FATAL_PARSE_ERRORS
+    /// ? Counters fed by both parser entry points.
+    const uint8_t stream[] = {
+        START_BYTE, 5, 'A', STOP_BYTE,                                 /// ? length mismatch
+        STOP_BYTE,                                                     /// ? stray STOP
+        START_BYTE, 70,                                                /// ? overflow
+        START_BYTE, 4, 'A', ESC_BYTE, START_BYTE ^ uCOMMS_ESC_XOR, 'B', 'C', STOP_BYTE,
+    };
+    static uCOMMS_STATS st;
+    uCOMMS_CONTEXT ctx = {.stats = &st};
+    for (size_t i = 0; i < sizeof(stream); i++) parse_cmd(&ctx, (char)stream[i]);
+    for (size_t off = 0; off < sizeof(stream);) off += parse_buf(&ctx, stream + off, sizeof(stream) - off);
+
+    TEST_ASSERT(st.bytes_in == 2 * sizeof(stream) && st.frames_in == 2, "bytes and frames in");
+    TEST_ASSERT(st.resyncs == 6 && st.length_mismatches == 2 && st.no_start == 2 && st.overflows == 2, "errors by kind");
+    TEST_ASSERT(st.escapes == 2 && st.crc_failures == 0, "escape sequences");
+
+    uCOMMS_STATS snap;
+    char text[1024];
+    ucomms_stats_snapshot(&st, &snap);
+    size_t n = ucomms_stats_format(&snap, text, sizeof(text));
+    TEST_ASSERT(n < sizeof(text) && strstr(text, "frames_in 2\n") && strstr(text, "overflows 2\n"), "formatted snapshot");
+    TEST_ASSERT(ucomms_stats_format(&snap, text, 8) == n && strlen(text) == 7, "short buffer should truncate");
+#endif
+    printf("    - Test link statistics and histograms\n");
+    return 1;
+}
+
+/// ? A fixed wire layout, checked at compile time.
+typedef struct uCOMMS_WIRE {
+    uint8_t  channel;
+    uint16_t raw;
+    int32_t  millivolts;
+} ADC_SAMPLE;
+uCOMMS_TLV_LAYOUT(ADC_SAMPLE, 7);
+
+int test_tlv_payloads(void) {
+    enum { OP_TELEMETRY = 300, F_COUNT = 1, F_OFFSET = 2, F_FLAGS = 3, F_ID = 4, F_STAMP = 5, F_NAME = 6, F_SAMPLE = 7 };
+    uint8_t buf[uCOMMS_MAX_PAYLOAD];
+    uCOMMS_TLV_WRITER w;
+    ADC_SAMPLE sample = {.channel = 3, .raw = 0x0102, .millivolts = -1250};
+
+    tlv_begin(&w, buf, sizeof(buf), OP_TELEMETRY);
+    tlv_put_uint(&w, F_COUNT, 5);
+    tlv_put_sint(&w, F_OFFSET, -2);
+    tlv_put_u16(&w, F_FLAGS, 0xBEEF);
+    tlv_put_u32(&w, F_ID, 0xDEADBEEF);
+    tlv_put_u64(&w, F_STAMP, 0x0123456789ABCDEFull);
+    tlv_put_bytes(&w, F_NAME, "FR", 2);
+    tlv_put_bytes(&w, F_SAMPLE, &sample, sizeof(sample));
+    size_t len = tlv_end(&w);
+    /// ? opcode 2 + uint 2 + sint 2 + u16 3 + u32 5 + u64 9 + name 4 + sample 9
+    TEST_ASSERT(len == 36, "message should be as compact as designed");
+
+    /// ? Through the framing and back, then read in place.
+    uint8_t wire[uCOMMS_ENCODED_MAX(uCOMMS_MAX_PAYLOAD)];
+    size_t n = encode_frame(buf, len, wire, sizeof(wire));
+    uCOMMS_CONTEXT ctx = {0};
+    for (size_t i = 0; i + 1 < n; i++) parse_cmd(&ctx, (char)wire[i]);
+    TEST_ASSERT(parse_cmd(&ctx, (char)wire[n - 1]) == PARSE_FRAME, "TLV payload should survive framing");
+
+    uCOMMS_TLV_READER r;
+    uCOMMS_TLV_FIELD f;
+    TEST_ASSERT(tlv_reader_init(&r, ctx.comms_buf, ctx.curr_cmd_len) == 0 && r.opcode == OP_TELEMETRY, "opcode");
+    TEST_ASSERT(tlv_next(&r, &f) == 1 && f.id == F_COUNT && f.kind == uCOMMS_TLV_UINT && f.u == 5, "uint field");
+    TEST_ASSERT(tlv_next(&r, &f) == 1 && f.id == F_OFFSET && f.i == -2, "sint field");
+    TEST_ASSERT(tlv_next(&r, &f) == 1 && f.id == F_FLAGS && f.u == 0xBEEF, "fixed16 field");
+    TEST_ASSERT(tlv_next(&r, &f) == 1 && f.id == F_ID && f.u == 0xDEADBEEF, "fixed32 field");
+    TEST_ASSERT(tlv_next(&r, &f) == 1 && f.id == F_STAMP && f.u == 0x0123456789ABCDEFull, "fixed64 field");
+    TEST_ASSERT(tlv_next(&r, &f) == 1 && f.id == F_NAME && f.bytes.len == 2 && memcmp(f.bytes.ptr, "FR", 2) == 0, "bytes field");
+    TEST_ASSERT(f.bytes.ptr >= ctx.comms_buf && f.bytes.ptr < ctx.comms_buf + ctx.curr_cmd_len, "bytes should point into the frame");
+    TEST_ASSERT(tlv_next(&r, &f) == 1 && f.id == F_SAMPLE, "layout field");
+    const ADC_SAMPLE *s = tlv_layout(&f, ADC_SAMPLE);
+    TEST_ASSERT(s && s->channel == 3 && s->raw == 0x0102 && s->millivolts == -1250, "layout read in place");
+    TEST_ASSERT(tlv_next(&r, &f) == 0, "end of payload");
+
+    TEST_ASSERT(tlv_find(buf, len, F_ID, &f) == 1 && f.u == 0xDEADBEEF, "tlv_find() should find a field");
+    TEST_ASSERT(tlv_find(buf, len, 99, &f) == 0, "tlv_find() of a missing field");
+    TEST_ASSERT(tlv_find(buf, len, F_NAME, &f) == 1 && tlv_layout(&f, ADC_SAMPLE) == NULL, "layout of the wrong size");
+
+    /// ? Truncated anywhere is reported, never read past.
+    for (size_t cut = 2; cut < len; cut++) {
+        uCOMMS_TLV_READER t;
+        int rc = 1, fields = 0;
+        tlv_reader_init(&t, buf, cut);
+        while ((rc = tlv_next(&t, &f)) == 1) fields++;
+        TEST_ASSERT(rc == -1 || fields < 7, "truncated payload should stop early");
+    }
+    TEST_ASSERT(tlv_find(buf, len - 1, F_SAMPLE, &f) == -1, "cut BYTES field should be malformed");
+
+    /// ? Overflow is sticky and reported by tlv_end().
+    tlv_begin(&w, buf, 4, OP_TELEMETRY);
+    tlv_put_u64(&w, F_STAMP, 1);
+    tlv_put_uint(&w, F_COUNT, 1);
+    TEST_ASSERT(tlv_end(&w) == 0, "overflowing message should be refused");
+    printf("    - Test TLV payload builder and reader\n");
+    return 1;
+}
+
+int test_lz_pack(void) {
+    static uint8_t text[4000], packed[4001], back[4000], random_bytes[500];
+    size_t tlen = 0;
+    for (int k = 0; tlen + 40 < sizeof(text); k++) {
+        tlen += (size_t)snprintf((char *)text + tlen, sizeof(text) - tlen, "GET:FR=%d,TEMP=21.%d,STATE=OK;", k % 50, k % 10);
+    }
+    srand(7);
+    for (size_t i = 0; i < sizeof(random_bytes); i++) random_bytes[i] = (uint8_t)rand();
+
+    /// ? Repetitive telemetry shrinks and comes back the same.
+    uCOMMS_VIEW v;
+    size_t n = ucomms_pack(text, tlen, packed, sizeof(packed));
+    TEST_ASSERT(packed[0] == uCOMMS_PACK_LZ && n < tlen / 2, "telemetry text should at least halve");
+    TEST_ASSERT(ucomms_unpack(packed, n, back, sizeof(back), &v) == 0, "compressed payload should unpack");
+    TEST_ASSERT(v.len == tlen && memcmp(v.ptr, text, tlen) == 0 && v.ptr == (const char *)back, "round trip");
+
+    /// ? Incompressible data goes raw, one byte dearer, and is not copied out.
+    n = ucomms_pack(random_bytes, sizeof(random_bytes), packed, sizeof(packed));
+    TEST_ASSERT(packed[0] == 0 && n == sizeof(random_bytes) + 1, "random data should be sent raw");
+    TEST_ASSERT(ucomms_unpack(packed, n, back, sizeof(back), &v) == 0 && v.ptr == (const char *)packed + 1, "raw body is a view");
+    TEST_ASSERT(v.len == sizeof(random_bytes) && memcmp(v.ptr, random_bytes, v.len) == 0, "raw round trip");
+
+    /// ? Long runs use overlapping matches, tiny payloads are left alone.
+    memset(text, 'A', 1000);
+    n = ucomms_pack(text, 1000, packed, sizeof(packed));
+    TEST_ASSERT(n < 50 && ucomms_unpack(packed, n, back, sizeof(back), &v) == 0 && v.len == 1000 && back[999] == 'A', "run");
+    for (size_t len = 0; len < 4; len++) {
+        n = ucomms_pack("TOG", len, packed, sizeof(packed));
+        TEST_ASSERT(n == len + 1 && packed[0] == 0, "tiny payloads should go raw");
+    }
+    TEST_ASSERT(ucomms_pack(text, 100, packed, 100) == 0, "output buffer must hold len + 1");
+
+    /// ? Malformed input is refused, never written past.
+    n = ucomms_pack(text, 1000, packed, sizeof(packed));
+    TEST_ASSERT(ucomms_unpack(packed, n, back, 999, &v) == -1, "too small output should be refused");
+    TEST_ASSERT(ucomms_unpack(packed, n - 1, back, sizeof(back), &v) == -1, "cut stream should be refused");
+    const uint8_t far_back[] = {uCOMMS_PACK_LZ, 10, 0x01, 5, 0};
+    TEST_ASSERT(ucomms_unpack(far_back, sizeof(far_back), back, sizeof(back), &v) == -1, "match before the start");
+    const uint8_t bad_flags[] = {0x80, 'A'};
+    TEST_ASSERT(ucomms_unpack(bad_flags, sizeof(bad_flags), back, sizeof(back), &v) == -1, "unknown flags");
+    printf("    - Test LZ payload compression\n");
+    return 1;
+}
+
+/// ? Per stream frame digest for the group test.
+typedef struct {
+    uint64_t hash;
+    int      count;
+} FRAME_DIGEST;
+
+static void digest_frame(FRAME_DIGEST *d, const uint8_t *payload, size_t len) {
+    d->hash = (d->hash ^ len) * 0x100000001B3ull;
+    for (size_t i = 0; i < len; i++) d->hash = (d->hash ^ payload[i]) * 0x100000001B3ull;
+    d->count++;
+}
+
+static void digest_group_frame(void *user, size_t stream, const uint8_t *payload, size_t len) {
+    digest_frame((FRAME_DIGEST *)user + stream, payload, len);
+}
+
+static size_t put_bytes(uint8_t *dst, size_t at, const uint8_t *src, size_t len) {
+    memcpy(dst + at, src, len);
+    return at + len;
+}
+
+/// ? Hand made stream for the group test: escaped payload, length and CRC
+/// ? bytes, and every way a frame can be malformed. Returns its length and
+/// ? the good and bad frames in it.
+static size_t group_edge_cases(uint8_t mode, uint8_t *out, int *good, int *bad) {
+    uint8_t wire[128], payload[32];
+    size_t  n = 0, w;
+    *good = *bad = 0;
+
+    /// ? Reserved bytes in the payload, and lengths that are reserved bytes.
+    const uint8_t reserved[] = {START_BYTE, 'A', STOP_BYTE, ESC_BYTE, 'B'};
+    w = encode_frame_crc(mode, reserved, sizeof(reserved), wire, sizeof(wire));
+    n = put_bytes(out, n, wire, w); (*good)++;
+    const size_t reserved_lens[] = {START_BYTE, STOP_BYTE, ESC_BYTE};
+    for (int i = 0; i < 3; i++) {
+        memset(payload, 'x', reserved_lens[i]);
+        w = encode_frame_crc(mode, payload, reserved_lens[i], wire, sizeof(wire));
+        n = put_bytes(out, n, wire, w); (*good)++;
+    }
+
+    /// ? A clean payload whose CRC trailer needs escaping.
+    if (mode) {
+        size_t clean = 1 + 1 + 4 + crc_size(mode) + 1;
+        for (payload[0] = 'a';; payload[0]++) {
+            memcpy(payload + 1, "crc", 3);
+            w = encode_frame_crc(mode, payload, 4, wire, sizeof(wire));
+            if (w > clean) break;
+        }
+        n = put_bytes(out, n, wire, w); (*good)++;
+    }
+
+    const uint8_t esc_esc[]   = {START_BYTE, 4, 'a', ESC_BYTE, ESC_BYTE, 'b', STOP_BYTE};
+    const uint8_t no_start[]  = {STOP_BYTE};
+    const uint8_t no_length[] = {START_BYTE, STOP_BYTE};
+    const uint8_t oversize[]  = {START_BYTE, 0xFF, 0x7F, 'x', 'y', STOP_BYTE};
+    const uint8_t esc_stop[]  = {START_BYTE, 1, 'a', ESC_BYTE, STOP_BYTE};
+    const uint8_t short_len[] = {START_BYTE, 4, 'a', STOP_BYTE};
+    n = put_bytes(out, n, esc_esc, sizeof(esc_esc));
+    n = put_bytes(out, n, no_start, sizeof(no_start));
+    n = put_bytes(out, n, no_length, sizeof(no_length));
+    n = put_bytes(out, n, oversize, sizeof(oversize));
+    n = put_bytes(out, n, esc_stop, sizeof(esc_stop));
+    n = put_bytes(out, n, short_len, sizeof(short_len));
+    *bad += 6;
+
+    /// ? A frame cut short by the next START_BYTE is dropped, the next one is fine.
+    const uint8_t cut[] = {START_BYTE, 5, 'a', 'b'};
+    n = put_bytes(out, n, cut, sizeof(cut));
+    w = encode_frame_crc(mode, (const uint8_t *)"after", 5, wire, sizeof(wire));
+    n = put_bytes(out, n, wire, w); (*good)++; (*bad)++;
+
+    if (mode) {
+        /// ? Wrong trailer, and one trailer byte too many.
+        w = encode_frame_crc(mode, (const uint8_t *)"trailer", 7, wire, sizeof(wire));
+        uint8_t flip = 1;
+        while (IS_RESERVED_BYTE(wire[w - 2] ^ flip)) flip <<= 1;
+        wire[w - 2] ^= flip;
+        n = put_bytes(out, n, wire, w);
+        wire[w - 2] ^= flip;
+        wire[w - 1] = 'z';
+        wire[w]     = STOP_BYTE;
+        n = put_bytes(out, n, wire, w + 1);
+        *bad += 2;
+    }
+
+    w = encode_frame_crc(mode, (const uint8_t *)"last", 4, wire, sizeof(wire));
+    n = put_bytes(out, n, wire, w); (*good)++;
+    return n;
+}
+
+int test_parser_group(void) {
+    enum { STREAMS = 6, CAP = 128, STREAM_BYTES = 16384 };
+    static uint8_t data[STREAMS][STREAM_BYTES];
+    static char    bufs[STREAMS][CAP];
+    static _Alignas(64) uint8_t mem[8192];
+    TEST_ASSERT(ucomms_group_mem_size(STREAMS, CAP) <= sizeof(mem), "group fits its memory");
+
+    for (uint8_t mode = uCOMMS_CRC_NONE; mode <= uCOMMS_CRC32C; mode++) {
+        /// ? The hand made cases, every stream cut into chunks of its own size.
+        static uint8_t edge[1024];
+        int    good, bad;
+        size_t elen = group_edge_cases(mode, edge, &good, &bad);
+        const size_t step[STREAMS] = {1, 2, 3, 7, 64, elen};
+        uCOMMS_CONTEXT ectx[STREAMS];
+        FRAME_DIGEST ewant[STREAMS] = {0}, egot[STREAMS] = {0};
+        uCOMMS_PARSER_GROUP eg;
+        ucomms_group_init(&eg, mem, STREAMS, CAP, mode);
+        for (int s = 0; s < STREAMS; s++) {
+            memset(&ectx[s], 0, sizeof(ectx[s]));
+            attach_buffer(&ectx[s], bufs[s], CAP);
+            ectx[s].crc_mode = mode;
+        }
+        for (size_t off = 0; off < elen; off++) {
+            const uint8_t *chunk[STREAMS];
+            size_t clen[STREAMS];
+            for (int s = 0; s < STREAMS; s++) {
+                /// ? Stream s gets a chunk every step[s] bytes.
+                clen[s]  = off % step[s] ? 0 : (elen - off < step[s] ? elen - off : step[s]);
+                chunk[s] = edge + off;
+                for (size_t i = 0; i < clen[s];) {
+                    i += parse_buf(&ectx[s], chunk[s] + i, clen[s] - i);
+                    if (frame_ready(&ectx[s])) digest_frame(&ewant[s], (const uint8_t *)bufs[s], ectx[s].curr_cmd_len);
+                }
+            }
+            ucomms_group_parse(&eg, chunk, clen, digest_group_frame, egot);
+        }
+        for (int s = 0; s < STREAMS; s++) {
+            TEST_ASSERT(egot[s].count == good && eg.dropped[s] == (uint32_t)bad, "group takes the good edge cases and drops the bad ones");
+            TEST_ASSERT(ewant[s].count == good && ectx[s].dropped_frames == (uint32_t)bad, "parse_buf() takes the good edge cases and drops the bad ones");
+            TEST_ASSERT(egot[s].hash == ewant[s].hash, "group edge case frames match parse_buf()");
+        }
+
+        /// ? Frames of every size up to the cap and beyond, reserved bytes, line
+        /// ? noise and the odd flipped byte, so every error path gets hit.
+        size_t len[STREAMS];
+        srand(7 + mode);
+        for (int s = 0; s < STREAMS; s++) {
+            size_t n = 0;
+            uint8_t payload[160], wire[400];
+            while (n + sizeof(wire) < STREAM_BYTES) {
+                size_t plen = (size_t)rand() % 140;
+                for (size_t k = 0; k < plen; k++) payload[k] = (uint8_t)(rand() % 8 ? rand() : (int[]){2, 3, 16}[rand() % 3]);
+                size_t w = encode_frame_crc(mode, payload, plen, wire, sizeof(wire));
+                if (rand() % 10 == 0) wire[(size_t)rand() % w] ^= (uint8_t)(1 + rand() % 255);
+                if (rand() % 5 == 0) data[s][n++] = (uint8_t)rand();
+                memcpy(data[s] + n, wire, w);
+                n += w;
+            }
+            len[s] = n;
+        }
+
+        uCOMMS_CONTEXT ctx[STREAMS];
+        FRAME_DIGEST want[STREAMS] = {0}, got[STREAMS] = {0};
+        uCOMMS_PARSER_GROUP g;
+        ucomms_group_init(&g, mem, STREAMS, CAP, mode);
+        for (int s = 0; s < STREAMS; s++) {
+            memset(&ctx[s], 0, sizeof(ctx[s]));
+            attach_buffer(&ctx[s], bufs[s], CAP);
+            ctx[s].crc_mode = mode;
+        }
+
+        /// ? Every stream gets its own random chunk each round.
+        size_t off[STREAMS] = {0};
+        for (int left = STREAMS; left;) {
+            const uint8_t *chunk[STREAMS];
+            size_t clen[STREAMS];
+            left = 0;
+            for (int s = 0; s < STREAMS; s++) {
+                clen[s]  = (size_t)rand() % 300;
+                if (clen[s] > len[s] - off[s]) clen[s] = len[s] - off[s];
+                chunk[s] = data[s] + off[s];
+                for (size_t i = 0; i < clen[s];) {
+                    i += parse_buf(&ctx[s], chunk[s] + i, clen[s] - i);
+                    if (frame_ready(&ctx[s])) digest_frame(&want[s], (const uint8_t *)bufs[s], ctx[s].curr_cmd_len);
+                }
+                off[s] += clen[s];
+                left += off[s] < len[s];
+            }
+            ucomms_group_parse(&g, chunk, clen, digest_group_frame, got);
+        }
+
+        int same = 1, frames = 0;
+        for (int s = 0; s < STREAMS; s++) {
+            same &= want[s].count == got[s].count && want[s].hash == got[s].hash;
+            same &= g.frames[s] == (uint32_t)got[s].count && g.dropped[s] == ctx[s].dropped_frames;
+            frames += got[s].count;
+        }
+        printf("[CRC MODE %u]: %d frames, %u dropped on stream 0\n", mode, frames, g.dropped[0]);
+        TEST_ASSERT(frames > 100 * STREAMS && g.dropped[0] > 0, "streams carry good and bad frames");
+        TEST_ASSERT(same, "group frames and drops match parse_buf() per stream");
+    }
+    printf("    - Test parser group against independent contexts\n");
+    return 1;
+}
+
+int test_fatal_parse_errors(void) {
+    printf("    - Test that parse errors exit in fatal mode\n");
+
+    TEST_EXPECT_CRASH({
+        uCOMMS_CONTEXT ctx = {0};
+        parse_cmd(&ctx, STOP_BYTE);
+    }, "STOP without START should crash");
+
+    TEST_EXPECT_CRASH({
+        uCOMMS_CONTEXT ctx = {0};
+        parse_cmd(&ctx, START_BYTE);
+        parse_cmd(&ctx, 5);
+        parse_cmd(&ctx, 'A');
+        parse_cmd(&ctx, STOP_BYTE);
+    }, "STOP with length mismatch should crash");
+
+    TEST_EXPECT_CRASH({
+        static _Alignas(64) uint8_t mem[1024];
+        static const uint8_t stop[] = {STOP_BYTE};
+        const uint8_t *chunk = stop;
+        size_t len = sizeof(stop);
+        uCOMMS_PARSER_GROUP g;
+        ucomms_group_init(&g, mem, 1, 64, uCOMMS_CRC_NONE);
+        ucomms_group_parse(&g, &chunk, &len, digest_group_frame, NULL);
+    }, "group should crash on STOP without START too");
+
+    return 1;
+}
+
+
 int main(void) {
     printf("=== uComms Parse Function Tests ===\n\n");
     
@@ -242,6 +1037,27 @@ int main(void) {
     // RUN_TEST(test_parse_start_byte);
     // RUN_TEST(test_parse_length_byte);
     RUN_TEST(test_parse_payload_bytes);
+    RUN_TEST(test_find_special);
+    RUN_TEST(test_truncated_frames);
+    RUN_TEST(test_parse_buf_matches_parse_cmd);
+    RUN_TEST(test_encode_clean_payload);
+    RUN_TEST(test_escape_roundtrip);
+    RUN_TEST(test_dispatch_table);
+    RUN_TEST(test_crc_check_values);
+    RUN_TEST(test_crc_frames);
+    RUN_TEST(test_large_frames);
+    RUN_TEST(test_pool_buffers);
+    RUN_TEST(test_stats_counters);
+    RUN_TEST(test_tlv_payloads);
+    RUN_TEST(test_lz_pack);
+#ifdef uCOMMS_FATAL_PARSE_ERRORS
+    RUN_TEST(test_fatal_parse_errors);
+    RUN_TEST(test_buffer_overflow_should_crash);
+#else
+    RUN_TEST(test_parse_error_status);
+    RUN_TEST(test_resync_within_chunk);
+    RUN_TEST(test_parser_group);
+#endif
     // RUN_TEST(test_parse_stop_byte);
     // RUN_TEST(test_parse_invalid_sequence);
     // RUN_TEST(test_null_pointer_should_crash);
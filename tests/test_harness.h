@@ -0,0 +1,64 @@
+#pragma once
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>     // for fork()
+#include <sys/wait.h>   // for waitpid()
+
+/// * Shared by every test executable, each one is a single translation unit.
+
+// Test helper macros
+#define TEST_ASSERT(condition, message)             \
+    do {                                            \
+        if (!(condition)) {                         \
+            fprintf(stderr, "FAIL: %s\n", message); \
+            return 0;                               \
+        } else {                                    \
+            printf("PASS: %s\n", message);          \
+        }                                           \
+    } while(0)
+
+
+// Test for functions expected to crash/exit
+#define TEST_EXPECT_CRASH(test_code, message)                                              \
+    do {                                                                                   \
+        pid_t pid = fork();                                                                \
+        if (pid == 0) {                                                                    \
+            test_code;                                                                     \
+            exit(0);                                                                       \
+        } else if (pid > 0) {                                                              \
+            int status;                                                                    \
+            waitpid(pid, &status, 0);                                                      \
+            if (WIFEXITED(status) && WEXITSTATUS(status) == 0) {                           \
+                fprintf(stderr, "FAIL: %s (expected crash but didn't crash)\n", message);  \
+                return 0;                                                                  \
+            } else {                                                                       \
+                printf("PASS: %s (crashed as expected)\n", message);                       \
+            }                                                                              \
+        } else {                                                                           \
+            fprintf(stderr, "FAIL: fork() failed for crash test\n");                       \
+            return 0;                                                                      \
+        }                                                                                  \
+    } while(0)
+
+
+#define RUN_TEST(test_func)                         \
+    do {                                            \
+        printf("Running %s...\n", #test_func);      \
+        if (test_func()) {                          \
+            printf("✓ %s passed\n\n", #test_func);  \
+            tests_passed++;                         \
+        } else {                                    \
+            printf("✗ %s failed\n\n", #test_func);  \
+            tests_failed++;                         \
+        }                                           \
+        total_tests++;                              \
+    } while(0)
+
+
+
+
+/// ? Test counters
+static int tests_passed = 0;
+static int tests_failed = 0;
+static int total_tests = 0;